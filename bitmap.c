@@ -18,7 +18,506 @@
 
 #include "myfs.h"
 
+
+#ifndef min_c
+#define min_c(a, b) (((a) < (b)) ? (a) : (b))
+#endif /* min_c */
+
+#ifndef max_c
+#define max_c(a, b) (((a) > (b)) ? (a) : (b))
+#endif /* max_c */
+
 static void sanity_check_bitmap(myfs_info *myfs);
+static int  release_blocks(myfs_info *myfs, fs_off_t start, fs_off_t len);
+
+/* how many free blocks we like to see after the start of a new run */
+#define ROOM_TO_GROW   64
+
+
+/*
+  the summary keeps, for every group of BBM_GROUP_BITS blocks, how many
+  blocks are free, the longest free run in the group and the free runs
+  at either end of it.  a run that crosses groups is the tail of one
+  group, any completely free groups after it and the head of the next.
+*/
+static void
+update_groups(block_bitmap *bbm, int start, int len)
+{
+    int g, last;
+
+    last = (start + len - 1) >> BBM_GROUP_SHIFT;
+    for(g=start >> BBM_GROUP_SHIFT; g <= last && g < bbm->num_groups; g++)
+        SummarizeBV(bbm->bv, g << BBM_GROUP_SHIFT, BBM_GROUP_BITS,
+                    &bbm->groups[g]);
+
+    bbm->biggest_free = -1;
+}
+
+
+/*
+  take the locks of the allocation groups that blocks start..start+len-1
+  fall in.  they're always taken in ascending order.
+*/
+static void
+lock_groups(myfs_info *myfs, fs_off_t start, fs_off_t len)
+{
+    int g, last;
+
+    last = (start + len - 1) >> BBM_GROUP_SHIFT;
+    for(g=start >> BBM_GROUP_SHIFT; g <= last && g < myfs->bbm.num_groups; g++)
+        acquire_sem(myfs->ags[g].sem);
+}
+
+
+static void
+unlock_groups(myfs_info *myfs, fs_off_t start, fs_off_t len)
+{
+    int g, last;
+
+    last = (start + len - 1) >> BBM_GROUP_SHIFT;
+    if (last >= myfs->bbm.num_groups)
+        last = myfs->bbm.num_groups - 1;
+    for(g=last; g >= (start >> BBM_GROUP_SHIFT); g--)
+        release_sem(myfs->ags[g].sem);
+}
+
+
+/*
+  the number of used blocks comes from the group summaries so there is
+  no single counter every allocation has to update.  the summaries
+  count the blocks sitting in reservation windows as used but they
+  aren't, not yet.
+*/
+fs_off_t
+myfs_used_blocks(myfs_info *myfs)
+{
+    int      g;
+    fs_off_t free_blocks = 0;
+
+    if (myfs->bbm.groups == NULL)
+        return myfs->dsb.used_blocks;
+
+    for(g=0; g < myfs->bbm.num_groups; g++)
+        free_blocks += myfs->bbm.groups[g].free;
+
+    return myfs->dsb.num_blocks - free_blocks - myfs->bbm.rsv_blocks;
+}
+
+
+/*
+  there are two copies of the bitmap.  bbm.bv is the one allocations
+  search and the summaries describe: it also has the blocks sitting in
+  reservation windows marked.  bbm.disk only has the blocks files
+  actually got and it's the one that gets written back.  the two only
+  differ by the windows.
+*/
+static BitVector *
+copy_bitmap(myfs_info *myfs, BitVector *bv)
+{
+    BitVector *copy;
+    size_t     nbytes = myfs->bbm.num_bitmap_blocks * myfs->dsb.block_size;
+
+    copy = (BitVector *)calloc(1, sizeof(BitVector));
+    if (copy == NULL)
+        return NULL;
+
+    copy->bits = (chunk *)malloc(nbytes);
+    if (copy->bits == NULL) {
+        free(copy);
+        return NULL;
+    }
+
+    memcpy(copy->bits, bv->bits, nbytes);
+    copy->numbits = bv->numbits;
+
+    return copy;
+}
+
+
+static void
+free_bitmap(BitVector *bv)
+{
+    if (bv == NULL)
+        return;
+
+    if (bv->bits)
+        free(bv->bits);
+    free(bv);
+}
+
+
+/*
+  a bitmap block isn't written every time one of its bits changes.  it
+  gets marked dirty and myfs_write_dirty_bitmap() hands all the dirty
+  ones to the cache at once, as few contiguous runs as it can, when the
+  volume is synced or unmounted.  the cache takes it from there.
+*/
+static void
+mark_bitmap_dirty(myfs_info *myfs, fs_off_t start, fs_off_t len)
+{
+    int       bsize = myfs->dsb.block_size;
+    fs_off_t  n, last;
+
+    last = (start + len - 1) / 8 / bsize;
+    for(n=start / 8 / bsize; n <= last; n++) {
+        if (myfs->bbm.dirty[n] == 0) {
+            myfs->bbm.dirty[n] = 1;
+            myfs->bbm.num_dirty++;
+        }
+    }
+
+    mark_super_dirty(myfs);
+}
+
+
+/*
+  write back the dirty bitmap blocks in block order.  this has to
+  happen before the super block goes out (and once there's a journal,
+  before the transaction that changed them is considered done).
+*/
+int
+myfs_write_dirty_bitmap(myfs_info *myfs)
+{
+    int    bsize = myfs->dsb.block_size, err = 0;
+    int    i, n, nblocks = myfs->bbm.num_bitmap_blocks;
+    char  *ptr;
+
+    if (myfs->bbm.dirty == NULL || myfs->bbm.num_dirty == 0)
+        return 0;
+
+    lock_groups(myfs, 0, myfs->dsb.num_blocks);
+
+    for(i=0; i < nblocks; i = n + 1) {
+        for(n=i; n < nblocks && myfs->bbm.dirty[n]; n++)
+            myfs->bbm.dirty[n] = 0;
+
+        if (n == i)
+            continue;
+
+        /* the +1 accounts for the super block */
+        ptr = (char *)myfs->bbm.disk->bits + (i * bsize);
+        if (write_blocks(myfs, i + 1, ptr, n - i) != n - i) {
+            printf("error: failed to write back bitmap blocks %d:%d!\n",
+                   i + 1, n - i);
+            err = EIO;
+        }
+        myfs->map_writes++;
+    }
+
+    myfs->bbm.num_dirty = 0;
+
+    unlock_groups(myfs, 0, myfs->dsb.num_blocks);
+
+    return err;
+}
+
+
+/*
+  sort the runs of free blocks in the bitmap by size: hist[i] counts the
+  runs of 2^i up to 2^(i+1)-1 blocks and the last bucket gets everything
+  bigger than that.  returns the total number of runs.
+*/
+int
+myfs_free_run_histogram(myfs_info *myfs, long *hist, int nbuckets)
+{
+    int  pos, len, i, runs = 0;
+
+    memset(hist, 0, nbuckets * sizeof(long));
+
+    lock_groups(myfs, 0, myfs->dsb.num_blocks);
+
+    for(pos=0; (pos = NextFreeRunBV(myfs->bbm.bv, pos, &len)) != -1; pos += len) {
+        for(i=0; i < nbuckets - 1 && (len >> (i + 1)) != 0; i++)
+            ;
+        hist[i]++;
+        runs++;
+    }
+
+    unlock_groups(myfs, 0, myfs->dsb.num_blocks);
+
+    return runs;
+}
+
+
+/* load every run of free blocks in the bitmap into a new free map */
+static int
+build_free_map(block_bitmap *bbm)
+{
+    int start, pos, len;
+
+    bbm->fm = new_free_map();
+    if (bbm->fm == NULL)
+        return ENOMEM;
+
+    for(pos=0; (start = NextFreeRunBV(bbm->bv, pos, &len)) != -1; pos = start + len) {
+        if (free_map_add(bbm->fm, start, len) != 0) {
+            delete_free_map(bbm->fm);
+            bbm->fm = NULL;
+            return ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+
+static void
+free_groups(myfs_info *myfs)
+{
+    int g;
+
+    if (myfs->ags) {
+        for(g=0; g < myfs->bbm.num_groups; g++)
+            if (myfs->ags[g].sem > 0)
+                delete_sem(myfs->ags[g].sem);
+        free(myfs->ags);
+        myfs->ags = NULL;
+    }
+
+    if (myfs->bbm.groups)
+        free(myfs->bbm.groups);
+    myfs->bbm.groups = NULL;
+
+    if (myfs->bbm.dirty)
+        free(myfs->bbm.dirty);
+    myfs->bbm.dirty     = NULL;
+    myfs->bbm.num_dirty = 0;
+}
+
+
+static int
+build_summary(myfs_info *myfs)
+{
+    block_bitmap *bbm = &myfs->bbm;
+    int           g;
+    char          name[32];
+
+    bbm->num_groups = (bbm->bv->numbits + BBM_GROUP_BITS - 1) >> BBM_GROUP_SHIFT;
+    bbm->groups = (BVRange *)calloc(bbm->num_groups, sizeof(BVRange));
+    myfs->ags   = (alloc_group *)calloc(bbm->num_groups, sizeof(alloc_group));
+    bbm->dirty  = (uchar *)calloc(bbm->num_bitmap_blocks, sizeof(uchar));
+    if (bbm->groups == NULL || myfs->ags == NULL || bbm->dirty == NULL) {
+        free_groups(myfs);
+        return ENOMEM;
+    }
+
+    for(g=0; g < bbm->num_groups; g++) {
+        sprintf(name, "ag%d", g);
+        myfs->ags[g].sem = create_sem(1, name);
+        if (myfs->ags[g].sem < 0) {
+            free_groups(myfs);
+            return ENOMEM;
+        }
+    }
+
+    update_groups(bbm, 0, bbm->bv->numbits);
+
+    return 0;
+}
+
+
+/* the longest run of free blocks on the whole disk */
+static int
+biggest_free_run(block_bitmap *bbm)
+{
+    int      g, run = 0, best = 0;
+    BVRange *gr;
+
+    if (bbm->biggest_free >= 0)
+        return bbm->biggest_free;
+
+    for(g=0; g < bbm->num_groups; g++) {
+        gr = &bbm->groups[g];
+        if (gr->free == BBM_GROUP_BITS) {
+            run += BBM_GROUP_BITS;
+            continue;
+        }
+
+        run += gr->head;
+        if (run > best)
+            best = run;
+        if (gr->longest > best)
+            best = gr->longest;
+        run = gr->tail;
+    }
+
+    if (run > best)
+        best = run;
+
+    bbm->biggest_free = best;
+    return best;
+}
+
+
+/*
+  find len free blocks starting somewhere in from..limit-1, which are
+  in one group, and take the first take of them.  looking only needs
+  that group's lock.  if the run carries on into the groups after it
+  we take their locks as well and make sure it's still free before we
+  mark it.
+*/
+static int
+claim_range(myfs_info *myfs, int from, int limit, int len, int take)
+{
+    block_bitmap *bbm = &myfs->bbm;
+    int           g = from >> BBM_GROUP_SHIFT, g2, last, start;
+
+    acquire_sem(myfs->ags[g].sem);
+
+    start = FindFreeRangeBV(bbm->bv, from, limit, len);
+    if (start == -1) {
+        release_sem(myfs->ags[g].sem);
+        return -1;
+    }
+
+    last = (start + len - 1) >> BBM_GROUP_SHIFT;
+    for(g2=g+1; g2 <= last; g2++)
+        acquire_sem(myfs->ags[g2].sem);
+
+    if (last == g || FindFreeRangeBV(bbm->bv, start, start + 1, len) == start) {
+        SetRangeBV(bbm->bv, start, take);
+        bbm->bv->next_free = start + take;
+        update_groups(bbm, start, take);
+    } else {
+        start = -1;       /* somebody beat us to part of it */
+    }
+
+    for(g2=last; g2 >= g; g2--)
+        release_sem(myfs->ags[g2].sem);
+
+    return start;
+}
+
+
+/*
+  find len free blocks starting in group g, at or after block from,
+  and take the first take of them.
+  the run can be inside the group or it can start in the group's tail
+  and carry on into the groups after it.  we only look at the bits if
+  the summaries say one of those will fit.
+*/
+static int
+group_fit(myfs_info *myfs, int g, int from, int len, int take)
+{
+    block_bitmap *bbm = &myfs->bbm;
+    BVRange      *gr = &bbm->groups[g];
+    int           g2, run;
+
+    run = gr->tail;
+    for(g2=g+1; g2 < bbm->num_groups && run > 0 && run < len; g2++) {
+        run += bbm->groups[g2].head;
+        if (bbm->groups[g2].free != BBM_GROUP_BITS)
+            break;
+    }
+
+    if (gr->longest < len && run < len)
+        return -1;
+
+    return claim_range(myfs, from, (g + 1) << BBM_GROUP_SHIFT, len, take);
+}
+
+
+/*
+  look for len free blocks as close to goal as we can: first in the
+  goal's group after it, then outward a group at a time on either side.
+*/
+static int
+search_outward(myfs_info *myfs, fs_off_t goal, int len, int take)
+{
+    block_bitmap *bbm = &myfs->bbm;
+    int           i, g, start;
+
+    g = goal >> BBM_GROUP_SHIFT;
+
+    start = group_fit(myfs, g, goal, len, take);
+    if (start != -1)
+        return start;
+
+    for(i=0; i < bbm->num_groups; i++) {
+        if (i > 0 && g + i < bbm->num_groups &&
+            (start = group_fit(myfs, g + i, (g + i) << BBM_GROUP_SHIFT,
+                               len, take)) != -1)
+            return start;
+
+        if (g - i >= 0 &&
+            (start = group_fit(myfs, g - i, (g - i) << BBM_GROUP_SHIFT,
+                               len, take)) != -1)
+            return start;
+    }
+
+    return -1;
+}
+
+
+/*
+  find and take len free blocks.  with a goal, the goal itself is best
+  of all.  failing that we'd rather not drop a growing file into a
+  little hole so we look for a spot near the goal with some room to
+  grow first and only then settle for any spot that fits.  without a
+  goal we start with the group that holds next_free and go around the
+  disk.  the summaries are read without locks; they're only hints and
+  claim_range() checks the bits themselves under the group locks.
+*/
+static int
+find_free_range(myfs_info *myfs, fs_off_t goal, int len)
+{
+    block_bitmap *bbm = &myfs->bbm;
+    int           i, g, base, start;
+
+    if (len > biggest_free_run(bbm))
+        return -1;
+
+    if (goal >= 0 && goal < bbm->bv->numbits) {
+        start = claim_range(myfs, goal, goal + 1, len, len);
+        if (start != -1)
+            return start;
+
+        /* the room to grow is only looked for, not taken */
+        if (len < ROOM_TO_GROW && ROOM_TO_GROW <= biggest_free_run(bbm) &&
+            (start = search_outward(myfs, goal, ROOM_TO_GROW, len)) != -1)
+            return start;
+
+        return search_outward(myfs, goal, len, len);
+    }
+
+    base = bbm->bv->next_free >> BBM_GROUP_SHIFT;
+    if (base < 0 || base >= bbm->num_groups)
+        base = 0;
+
+    for(i=0; i < bbm->num_groups; i++) {
+        g = (base + i) % bbm->num_groups;
+
+        start = group_fit(myfs, g, g << BBM_GROUP_SHIFT, len, len);
+        if (start != -1)
+            return start;
+    }
+
+    return -1;
+}
+
+
+/*
+  allocate len blocks and keep the summary up to date.  on failure
+  *biggest_free_chunk gets the longest run we could have had instead.
+*/
+static int
+get_free_range(myfs_info *myfs, fs_off_t goal, int len,
+               int *biggest_free_chunk)
+{
+    int start;
+
+    if (biggest_free_chunk)
+        *biggest_free_chunk = -1;
+
+    start = find_free_range(myfs, goal, len);
+    if (start == -1) {
+        if (biggest_free_chunk)
+            *biggest_free_chunk = biggest_free_run(&myfs->bbm);
+        return -1;
+    }
+
+    return start;
+}
 
 int
 myfs_create_storage_map(myfs_info *myfs)
@@ -74,6 +573,18 @@ myfs_create_storage_map(myfs_info *myfs)
         goto err;
     }
 
+    myfs->bbm.disk = copy_bitmap(myfs, myfs->bbm.bv);
+    if (myfs->bbm.disk == NULL) {
+        ret = ENOMEM;
+        goto err;
+    }
+
+    ret = build_summary(myfs);
+    if (ret == 0 && (myfs->dsb.features & MYFS_FEATURE_EXTENT_ALLOC))
+        ret = build_free_map(&myfs->bbm);
+    if (ret != 0)
+        goto err;
+
     /* write out the bitmap blocks, starting at block # 1 */
     amt = write_blocks(myfs, 1, buff, n);
     if (amt != n)  {
@@ -81,13 +592,18 @@ myfs_create_storage_map(myfs_info *myfs)
         goto err;
     }
         
-    myfs->dsb.used_blocks += num_blocks;
+    myfs->dsb.used_blocks = myfs_used_blocks(myfs);
 
     return 0;
 
  err:
+    free_groups(myfs);
+    free_bitmap(myfs->bbm.disk);
+    myfs->bbm.disk = NULL;
     if (buff)
         free(buff);
+    if (myfs->bbm.bv)
+        free(myfs->bbm.bv);
     myfs->bbm.bv = NULL;
     
     if (myfs->bbm_sem > 0)
@@ -152,16 +668,34 @@ myfs_init_storage_map(myfs_info *myfs)
         write_blocks(myfs, 1, myfs->bbm.bv[0].bits, 1);
     }
 
+    myfs->bbm.disk = copy_bitmap(myfs, myfs->bbm.bv);
+    if (myfs->bbm.disk == NULL) {
+        ret = ENOMEM;
+        goto err;
+    }
+
     printf("Checking block bitmap...\n");
     sanity_check_bitmap(myfs);
     printf("Done checking bitmap.\n");
 
+    ret = build_summary(myfs);
+    if (ret == 0 && (myfs->dsb.features & MYFS_FEATURE_EXTENT_ALLOC))
+        ret = build_free_map(&myfs->bbm);
+    if (ret != 0)
+        goto err;
+
+    myfs_count_group_inodes(myfs);
 
     return 0;
 
  err:
+    free_groups(myfs);
+    free_bitmap(myfs->bbm.disk);
+    myfs->bbm.disk = NULL;
     if (buff)
         free(buff);
+    if (myfs->bbm.bv)
+        free(myfs->bbm.bv);
     myfs->bbm.bv = NULL;
     if (myfs->bbm_sem > 0)
         delete_sem(myfs->bbm_sem);
@@ -173,6 +707,19 @@ myfs_init_storage_map(myfs_info *myfs)
 void
 myfs_shutdown_storage_map(myfs_info *myfs)
 {
+    if (myfs->bbm.fm) {
+        delete_free_map(myfs->bbm.fm);
+        myfs->bbm.fm = NULL;
+    }
+
+    /* the super block's count is only kept up to date from here on */
+    if (myfs->bbm.groups)
+        myfs->dsb.used_blocks = myfs_used_blocks(myfs);
+    free_groups(myfs);
+
+    free_bitmap(myfs->bbm.disk);
+    myfs->bbm.disk = NULL;
+
     if (myfs->bbm.bv) {
         if (myfs->bbm.bv->bits) {
             free(myfs->bbm.bv->bits);
@@ -188,32 +735,19 @@ myfs_shutdown_storage_map(myfs_info *myfs)
 }
 
 
+/*
+  the bitmap allocation policy: look for the whole run and if it isn't
+  there, settle for smaller ones depending on how exact the caller
+  needs it to be.  the number of blocks we got goes in *nblocks_ptr.
+*/
 static int
-real_allocate_blocks(myfs_info *myfs, fs_off_t *num_blocks,
-                     fs_off_t *start_addr, int do_log_write, int exact)
+bitmap_find_blocks(myfs_info *myfs, fs_off_t goal, int *nblocks_ptr, int exact)
 {
-    int        i, n, len, bsize = myfs->dsb.block_size, nblocks;
+    int        nblocks, start = -1;
     int        biggest_free_chunk = 0, max_free_chunk = 1;
-    fs_off_t   start = -1;
-    char      *ptr;
-    BitVector *bv;
-
-    if (*num_blocks <= 0)
-        return EINVAL;
 
-    /* XXXdbg -- when journaling is implemented, fix this */
-    do_log_write = 0;
-
-    acquire_sem(myfs->bbm_sem);
-
-    if (*num_blocks > (myfs->dsb.num_blocks - myfs->dsb.used_blocks)) {
-        release_sem(myfs->bbm_sem);
-        return ENOSPC;
-    }
-
-    for(nblocks=*num_blocks; nblocks >= 1; nblocks /= 2) {
-        bv = myfs->bbm.bv;
-        start = GetFreeRangeOfBits(bv, nblocks, &biggest_free_chunk);
+    for(nblocks=*nblocks_ptr; nblocks >= 1; nblocks /= 2) {
+        start = get_free_range(myfs, goal, nblocks, &biggest_free_chunk);
         if (start != -1)
             break;
  
@@ -224,7 +758,7 @@ real_allocate_blocks(myfs_info *myfs, fs_off_t *num_blocks,
         if (exact == LOOSE_ALLOCATION && biggest_free_chunk > 0 &&
             biggest_free_chunk >= (nblocks>>4)) {
             nblocks = biggest_free_chunk;
-            start = GetFreeRangeOfBits(bv, nblocks, NULL);
+            start = get_free_range(myfs, goal, nblocks, NULL);
             if (start != -1)
                 break;
         }
@@ -236,11 +770,9 @@ real_allocate_blocks(myfs_info *myfs, fs_off_t *num_blocks,
             if (max_free_chunk < nblocks)
                 nblocks = max_free_chunk;
 
-            start = GetFreeRangeOfBits(bv, nblocks, &biggest_free_chunk);
-            if (start != -1) {
-                i  = 0;
+            start = get_free_range(myfs, goal, nblocks, &biggest_free_chunk);
+            if (start != -1)
                 break;
-            }
         }
 
         if (exact == LOOSE_ALLOCATION && nblocks > max_free_chunk*2) {
@@ -250,51 +782,323 @@ real_allocate_blocks(myfs_info *myfs, fs_off_t *num_blocks,
         max_free_chunk = 1;
     }
 
-    if (start == -1) {
+    *nblocks_ptr = nblocks;
+    return start;
+}
+
+
+/*
+  the extent allocation policy: the free map picks the run and then
+  the bitmap (which is what's on disk) gets brought up to date.  the
+  free map is one structure for the whole disk so this is done under
+  bbm_sem, with the group locks held while the bits change.
+*/
+static int
+extent_find_blocks(myfs_info *myfs, fs_off_t goal, int *nblocks_ptr, int exact)
+{
+    fs_off_t start, got;
+
+    acquire_sem(myfs->bbm_sem);
+    if (free_map_alloc(myfs->bbm.fm, goal, *nblocks_ptr,
+                       (goal >= 0) ? ROOM_TO_GROW : 0, exact,
+                       &start, &got) != 0) {
         release_sem(myfs->bbm_sem);
-        return ENOSPC;
+        return -1;
     }
+
+    lock_groups(myfs, start, got);
+    SetRangeBV(myfs->bbm.bv, start, got);
+    update_groups(&myfs->bbm, start, got);
+    unlock_groups(myfs, start, got);
+
+    release_sem(myfs->bbm_sem);
+
+    *nblocks_ptr = got;
+    return start;
+}
+
+
+/*
+  find and take free blocks in bbm.bv only.  that's all a reservation
+  window needs; real_allocate_blocks() goes on to commit them.
+*/
+static int
+find_blocks(myfs_info *myfs, fs_off_t goal, fs_off_t *num_blocks,
+            fs_off_t *start_addr, int exact)
+{
+    int        nblocks;
+    fs_off_t   start = -1, avail;
+    bigtime_t  t;
+
+    if (*num_blocks <= 0)
+        return EINVAL;
+
+    /*
+       blocks reserved for delayed allocations are off limits.  there's
+       no lock around this: the count is a hint and the allocators will
+       come up empty if the blocks really aren't there.
+    */
+    avail = NUM_AVAIL_BLOCKS(myfs);
+    if (*num_blocks > avail) {
+        /* a loose request can make do with whatever is left */
+        if (exact == EXACT_ALLOCATION || avail <= 0)
+            return ENOSPC;
+
+        *num_blocks = avail;
+    }
+
+    nblocks = *num_blocks;
+
+    t = system_time();
+    if (myfs->bbm.fm)
+        start = extent_find_blocks(myfs, goal, &nblocks, exact);
+    else
+        start = bitmap_find_blocks(myfs, goal, &nblocks, exact);
+    myfs->bbm.alloc_time += system_time() - t;     /* just statistics */
+    myfs->bbm.alloc_calls++;
+
+    if (start == -1)
+        return ENOSPC;
     
 
     *start_addr = (fs_off_t)start;
     *num_blocks = nblocks;
 
+    return 0;
+}
+
+
+/* blocks from find_blocks() now belong to a file: mark them on disk too */
+static int
+commit_blocks(myfs_info *myfs, fs_off_t start, fs_off_t nblocks,
+              int do_log_write)
+{
+    int        i, n, len, bsize = myfs->dsb.block_size;
+    char      *ptr;
+
+    /* XXXdbg -- when journaling is implemented, fix this */
+    do_log_write = 0;
+
+    lock_groups(myfs, start, nblocks);
+    SetRangeBV(myfs->bbm.disk, start, nblocks);
+    unlock_groups(myfs, start, nblocks);
+
     /*
        calculate the block number of the bitmap block we just modified.
        the +1 accounts for the super block.
     */
     n   = (start / 8 / bsize) + 1;
-    len = (nblocks / 8 / bsize) + 1;
+    len = ((start + nblocks - 1) / 8 / bsize) - (start / 8 / bsize) + 1;
     
-    ptr = (char *)bv->bits + (((start / 8) / bsize) * bsize);
+    ptr = (char *)myfs->bbm.disk->bits + (((start / 8) / bsize) * bsize);
 
     if (do_log_write)  {
         for(i=0; i < len; i++, ptr += bsize) {
             if (myfs_write_journal_entry(myfs, myfs->cur_je, n+i, ptr) != 1) {
                 printf("error:1 failed to write bitmap block run %d:1!\n",n+i);
-                release_sem(myfs->bbm_sem);
                 return EINVAL;
             }
         }
-    } else if (write_blocks(myfs, n, ptr, len) != len) {
-        printf("error: 2 failed to write back bitmap block @ block %d!\n", n);
-        release_sem(myfs->bbm_sem);
-        return EINVAL;
+    } else {
+        mark_bitmap_dirty(myfs, start, nblocks);
     }
 
-    myfs->dsb.used_blocks += *num_blocks;
-    release_sem(myfs->bbm_sem);
-
-    myfs->dsb.flags = MYFS_DIRTY;
+    mark_super_dirty(myfs);
 
     return 0;
 }
 
+
+static int
+real_allocate_blocks(myfs_info *myfs, fs_off_t goal, fs_off_t *num_blocks,
+                     fs_off_t *start_addr, int do_log_write, int exact)
+{
+    int err;
+
+    err = find_blocks(myfs, goal, num_blocks, start_addr, exact);
+    if (err != 0)
+        return err;
+
+    return commit_blocks(myfs, *start_addr, *num_blocks, do_log_write);
+}
+
+/*
+  where the data of a new file should go: the start of the allocation
+  group its inode is in, so files with nearby inode numbers (which were
+  usually created together) start out near each other.
+*/
+fs_off_t
+myfs_home_block(myfs_info *myfs, inode_addr ia)
+{
+    fs_off_t g;
+
+    if (myfs->bbm.num_groups == 0 || myfs->inodes_per_group == 0)
+        return -1;
+
+    g = ia / myfs->inodes_per_group;
+    if (g >= myfs->bbm.num_groups)
+        g = myfs->bbm.num_groups - 1;
+
+    return g << BBM_GROUP_SHIFT;
+}
+
+
+#define RSV_MIN_BLOCKS   8
+#define RSV_MAX_BLOCKS   256
+#define RSV_IDLE_TIME    1000000     /* usecs a window should last at most */
+
+
+static void
+discard_window(myfs_info *myfs, rsv_window *w)
+{
+    fs_off_t len = w->len;
+
+    if (len == 0)
+        return;
+
+    w->len = 0;
+    myfs->bbm.rsv_blocks   -= len;
+    myfs->bbm.rsv_returned += len;
+
+    release_blocks(myfs, w->start, len);
+}
+
+
+void
+myfs_release_window(myfs_info *myfs, myfs_inode *mi)
+{
+    rsv_window **ptr, *w = mi->etc->rsv;
+
+    if (w == NULL)
+        return;
+
+    discard_window(myfs, w);
+
+    for(ptr=&myfs->bbm.windows; *ptr; ptr=&(*ptr)->next) {
+        if (*ptr == w) {
+            *ptr = w->next;
+            break;
+        }
+    }
+
+    mi->etc->rsv = NULL;
+    free(w);
+}
+
+
+void
+myfs_release_all_windows(myfs_info *myfs)
+{
+    while(myfs->bbm.windows)
+        myfs_release_window(myfs, myfs->bbm.windows->mi);
+}
+
+
+/*
+  hand out blocks from a file's window, filling it first if it's empty.
+  a window that gets used up quickly is made bigger the next time and
+  one that sits around is made smaller, so each file's window follows
+  how fast it's being written.
+*/
+static int
+window_allocate(myfs_info *myfs, myfs_inode *mi, fs_off_t goal,
+                fs_off_t *num_blocks, fs_off_t *start_addr, int exact)
+{
+    rsv_window *w = mi->etc->rsv;
+    fs_off_t    n, want, start;
+    bigtime_t   now;
+    int         err;
+
+    if (w == NULL) {
+        w = (rsv_window *)calloc(1, sizeof(rsv_window));
+        if (w == NULL)
+            return ENOMEM;
+
+        w->mi   = mi;
+        w->size = RSV_MIN_BLOCKS;
+        w->next = myfs->bbm.windows;
+        myfs->bbm.windows = w;
+        mi->etc->rsv = w;
+    } else if (w->len > 0 && goal >= 0 && goal != w->start) {
+        /* the file isn't growing where we thought it would */
+        discard_window(myfs, w);
+        w->size = max_c(w->size / 2, RSV_MIN_BLOCKS);
+    }
+
+    if (w->len == 0) {
+        now = system_time();
+        if (w->last && now - w->last < RSV_IDLE_TIME)
+            w->size = min_c(w->size * 2, RSV_MAX_BLOCKS);
+        else if (w->last)
+            w->size = max_c(w->size / 2, RSV_MIN_BLOCKS);
+
+        /* don't hoard blocks when the disk is getting full */
+        want = *num_blocks + w->size;
+        if (want > NUM_AVAIL_BLOCKS(myfs) / 8)
+            want = *num_blocks;
+
+        err = find_blocks(myfs, goal, &want, &start, LOOSE_ALLOCATION);
+        if (err != 0)
+            return err;
+
+        if (want < *num_blocks && exact == EXACT_ALLOCATION) {
+            release_blocks(myfs, start, want);
+            return ENOSPC;
+        }
+
+        w->start = start;
+        w->len   = want;
+        w->last  = now;
+        myfs->bbm.rsv_blocks += want;
+        myfs->bbm.rsv_fills++;
+    }
+
+    n = min_c(*num_blocks, w->len);
+
+    *start_addr = w->start;
+    *num_blocks = n;
+
+    w->start += n;
+    w->len   -= n;
+    w->hits++;
+    myfs->bbm.rsv_blocks -= n;
+    myfs->bbm.rsv_hits++;
+
+    return commit_blocks(myfs, *start_addr, n, 1);
+}
+
+
+/*
+  start_hint is the block we'd like the run to start at (or -1 if we
+  don't care).  we search outward from it for the closest fit.  if mi
+  is a file that's open, the blocks come out of its reservation window.
+*/
 int
-myfs_allocate_blocks(myfs_info *myfs, fs_off_t start_hint,
+myfs_allocate_blocks(myfs_info *myfs, myfs_inode *mi, fs_off_t start_hint,
                      fs_off_t *num_blocks, fs_off_t *start_addr, int exact)
 {
-    return real_allocate_blocks(myfs, num_blocks, start_addr, 1, exact);
+    fs_off_t nblocks = *num_blocks;
+    int      err;
+
+    if (mi && mi->etc->opens > 0 &&
+        window_allocate(myfs, mi, start_hint, num_blocks, start_addr,
+                        exact) == 0)
+        return 0;
+
+    *num_blocks = nblocks;
+    err = real_allocate_blocks(myfs, start_hint, num_blocks, start_addr, 1,
+                               exact);
+
+    /* the space might be sitting in other files' windows */
+    if (err == ENOSPC && myfs->bbm.windows) {
+        myfs_release_all_windows(myfs);
+
+        *num_blocks = nblocks;
+        err = real_allocate_blocks(myfs, start_hint, num_blocks, start_addr,
+                                   1, exact);
+    }
+
+    return err;
 }
 
 
@@ -305,62 +1109,79 @@ myfs_allocate_blocks(myfs_info *myfs, fs_off_t start_hint,
 int
 pre_allocate_blocks(myfs_info *myfs, fs_off_t *num_blocks,fs_off_t *start_addr)
 {
-    return real_allocate_blocks(myfs, num_blocks, start_addr, 0,
+    return real_allocate_blocks(myfs, -1, num_blocks, start_addr, 0,
                                 LOOSE_ALLOCATION);
 }
 
 
-int
-myfs_free_blocks(myfs_info *myfs, fs_off_t start, fs_off_t num_blocks)
+/* give blocks back to the allocators: the other half of find_blocks() */
+static int
+release_blocks(myfs_info *myfs, fs_off_t start, fs_off_t num_blocks)
 {
-    int        i, n, len, bsize = myfs->dsb.block_size;
-    char      *ptr;
+    bigtime_t  t;
     BitVector *bv;
-    int        do_log_write = 0;   /* XXXdbg - revisit when journaling works */
 
-    
-    acquire_sem(myfs->bbm_sem);
+    t = system_time();
+    if (myfs->bbm.fm) {
+        acquire_sem(myfs->bbm_sem);
+        if (free_map_add(myfs->bbm.fm, start, num_blocks) != 0) {
+            release_sem(myfs->bbm_sem);
+            return EINVAL;
+        }
+    }
 
     bv = myfs->bbm.bv;
+    lock_groups(myfs, start, num_blocks);
     UnSetRangeBV(bv, start, num_blocks);
-
+    update_groups(&myfs->bbm, start, num_blocks);
     bv->is_full = 0;
-    
-    /*
-       calculate the block number of the bitmap block we just modified.
-       the +1 accounts for the super block.
-    */
-    n   = (start / 8 / bsize) + 1;
+    unlock_groups(myfs, start, num_blocks);
 
-    /*
-      the number of blocks modified is the number of bits modified divided
-      by the number of bits in a disk block.
-    */
-    len = (num_blocks / 8 / bsize) + 1;
+    if (myfs->bbm.fm)
+        release_sem(myfs->bbm_sem);
+
+    myfs->bbm.alloc_time += system_time() - t;
+    myfs->bbm.free_calls++;
+
+    return 0;
+}
 
-    ptr = (char *)bv->bits + (((start / 8) / bsize) * bsize);
 
-    for(i=0; i < len; i++, ptr += bsize) {
-        if (do_log_write) {
+int
+myfs_free_blocks(myfs_info *myfs, fs_off_t start, fs_off_t num_blocks)
+{
+    int        i, n, len, bsize = myfs->dsb.block_size;
+    char      *ptr;
+    int        do_log_write = 0;   /* XXXdbg - revisit when journaling works */
+
+    if (release_blocks(myfs, start, num_blocks) != 0)
+        return EINVAL;
+
+    lock_groups(myfs, start, num_blocks);
+    UnSetRangeBV(myfs->bbm.disk, start, num_blocks);
+    unlock_groups(myfs, start, num_blocks);
+    
+    if (do_log_write) {
+        /*
+           calculate the block number of the bitmap block we just
+           modified.  the +1 accounts for the super block.
+        */
+        n   = (start / 8 / bsize) + 1;
+        len = ((start + num_blocks - 1) / 8 / bsize) - (start / 8 / bsize) + 1;
+        ptr = (char *)myfs->bbm.disk->bits + (((start / 8) / bsize) * bsize);
+
+        for(i=0; i < len; i++, ptr += bsize) {
             if (myfs_write_journal_entry(myfs, myfs->cur_je, n+i, ptr) != 1) {
                 printf("error: bitmap free: failed to write back bitmap "
                        "block run %d:1!\n", n+i);
-                release_sem(myfs->bbm_sem);
                 return EINVAL;
             }
-        } else if (write_blocks(myfs, n+i, ptr, 1) != 1) {
-            printf("error: bitmap free:2: failed to write back bitmap "
-                   "block @ block %d!\n", n);
-            release_sem(myfs->bbm_sem);
-            return EINVAL;
         }
+    } else {
+        mark_bitmap_dirty(myfs, start, num_blocks);
     }
 
-    myfs->dsb.used_blocks -= len;
-
-    release_sem(myfs->bbm_sem);
-
-    myfs->dsb.flags = MYFS_DIRTY;
+    mark_super_dirty(myfs);
 
     return 0;
 }
@@ -373,17 +1194,22 @@ myfs_check_blocks(myfs_info *myfs, fs_off_t start, fs_off_t len, int state)
     int        i;
     BitVector *bv;
 
-    acquire_sem(myfs->bbm_sem);
+    if (myfs->bbm.fm) {
+        acquire_sem(myfs->bbm_sem);
+        i = free_map_check(myfs->bbm.fm, start, len, state);
+        release_sem(myfs->bbm_sem);
+        return i;
+    }
 
     bv = myfs->bbm.bv;
+    lock_groups(myfs, start, len);
     for(i=0; i < len; i++) {
         if ((state == 1 && !IsSetBV(bv, start + i)) ||
             (state == 0 && IsSetBV(bv, start + i))) {
             break;
         }
     }
-
-    release_sem(myfs->bbm_sem);
+    unlock_groups(myfs, start, len);
  
     if (i != len) {
         return 0;
@@ -396,18 +1222,9 @@ myfs_check_blocks(myfs_info *myfs, fs_off_t start, fs_off_t len, int state)
 static void
 sanity_check_bitmap(myfs_info *myfs)
 {
-    int        i, j, k, *ptr;
-    fs_off_t   used_blocks = 0;
-    BitVector *bv;
+    fs_off_t   used_blocks;
 
-    bv = myfs->bbm.bv;
-    ptr = bv->bits;
-
-    for(j=0; j < bv->numbits/(sizeof(int)*8); j++) {
-        for(k=0; k < sizeof(chunk)*CHAR_BIT; k++)
-            if (ptr[j] & (1 << k))
-                used_blocks++;
-    }
+    used_blocks = CountBitsBV(myfs->bbm.disk);
 
     if (myfs->dsb.used_blocks != used_blocks) {
         printf("*** super block sez %ld used blocks but it's really %ld\n",
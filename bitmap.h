@@ -7,11 +7,37 @@ int  myfs_create_storage_map(myfs_info *myfs);
 int  myfs_init_storage_map(myfs_info *myfs);
 void myfs_shutdown_storage_map(myfs_info *myfs);
 
-int  myfs_allocate_blocks(myfs_info *myfs, fs_off_t start_hint,
+int  myfs_allocate_blocks(myfs_info *myfs, myfs_inode *mi, fs_off_t start_hint,
                           fs_off_t *num_blocks,fs_off_t *start_addr,int flags);
 int  pre_allocate_blocks(myfs_info *myfs,fs_off_t *num_blocks,fs_off_t *start_addr);
 int  myfs_free_blocks(myfs_info *myfs, fs_off_t start, fs_off_t len);
 int  myfs_check_blocks(myfs_info *myfs, fs_off_t start,fs_off_t len,int state);
+fs_off_t myfs_home_block(myfs_info *myfs, inode_addr ia);
+fs_off_t myfs_used_blocks(myfs_info *myfs);
+int  myfs_free_run_histogram(myfs_info *myfs, long *hist, int nbuckets);
+int  myfs_write_dirty_bitmap(myfs_info *myfs);
+void myfs_release_window(myfs_info *myfs, myfs_inode *mi);
+void myfs_release_all_windows(myfs_info *myfs);
+
+/*
+  a reservation window is a run of blocks set aside for a file that is
+  open and being written so that its next blocks come from right after
+  its last ones, no matter what other files are growing at the same
+  time.  a window's blocks are only marked in the in-memory copy of the
+  bitmap that allocations search, never in the one that goes to disk.
+  a block gets marked on disk when it's handed to the file and the ones
+  that don't get used go back when the file is closed.  so a crash
+  can't leave a window's blocks allocated.
+*/
+typedef struct rsv_window {
+    struct rsv_window *next;
+    myfs_inode        *mi;        /* the file it's for */
+    fs_off_t           start;     /* next block the file will get */
+    fs_off_t           len;       /* blocks left in the window */
+    fs_off_t           size;      /* how big to make the next one */
+    long               hits;      /* allocations it satisfied */
+    bigtime_t          last;      /* when it was last filled */
+} rsv_window;
 
 /*
  * these are the flags for the last argument to myfs_allocate_blocks()
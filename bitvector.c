@@ -15,6 +15,61 @@
 #include "compat.h"
 #include "bitvector.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+  the chunks in a BitVector are the on-disk bitmap blocks so they stay
+  ints, but the searching is done a 64-bit word (two chunks) at a time.
+  bit n of a word is always bit n%32 of chunk 2*w + n/32, regardless of
+  the byte order of the machine.
+*/
+typedef uint64 bvword;
+
+#define BITS_IN_WORD   64
+#define ALL_ONES       (~(bvword)0)
+
+#ifdef __GNUC__
+#define ctz64(x)       __builtin_ctzll(x)
+#define clz64(x)       __builtin_clzll(x)
+#define popcount64(x)  __builtin_popcountll(x)
+#else
+static int
+ctz64(bvword x)
+{
+    int n = 0;
+
+    while ((x & 1) == 0) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+
+static int
+clz64(bvword x)
+{
+    int n = 0;
+
+    while ((x >> (BITS_IN_WORD - 1)) == 0) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+}
+
+static int
+popcount64(bvword x)
+{
+    int n;
+
+    for(n=0; x; n++)
+        x &= x - 1;
+    return n;
+}
+#endif
+
 
 /* Set a bit in a BitVector.
  *
@@ -34,7 +89,7 @@ SetBV(BitVector *bv, int which)
     i = which / BITS_IN_CHUNK;       /* i == index to bv->bits         */
     j = which % BITS_IN_CHUNK;       /* j == bit inside of bv->bits[i] */
     
-    bv->bits[i] |= (1 << j);
+    bv->bits[i] |= (chunk)(1U << j);
     
     return TRUE;
 }
@@ -58,29 +113,64 @@ UnSetBV(BitVector *bv, int which)
     i = which / BITS_IN_CHUNK;       /* i == index to bv->bits         */
     j = which % BITS_IN_CHUNK;       /* j == bit inside of bv->bits[i] */
     
-    bv->bits[i]   &= ~(1 << j);
+    bv->bits[i]   &= ~(chunk)(1U << j);
     bv->next_free  = which;
     
     return TRUE;
 }
 
 
+/*
+  set (or clear) len bits starting at start.  the partial chunks at
+  either end get masked and everything in between is stored whole.
+*/
+static void
+change_range(BitVector *bv, int start, int len, int set)
+{
+    int    i, first, last;
+    uint32 mask;
+
+    first = start / BITS_IN_CHUNK;
+    last  = (start + len - 1) / BITS_IN_CHUNK;
+
+    for(i=first; i <= last; i++) {
+        mask = ~(uint32)0;
+        if (i == first)
+            mask &= ~(uint32)0 << (start % BITS_IN_CHUNK);
+        if (i == last)
+            mask &= ~(uint32)0 >> (BITS_IN_CHUNK - 1 - ((start + len - 1) % BITS_IN_CHUNK));
+
+        if (set)
+            bv->bits[i] |= (chunk)mask;
+        else
+            bv->bits[i] &= (chunk)~mask;
+    }
+}
+
+
+int
+SetRangeBV(BitVector *bv, int start, int len)
+{
+    if (start < 0 || len < 0 || start+len > bv->numbits)
+        return FALSE;
+
+    if (len > 0)
+        change_range(bv, start, len, 1);
+
+    return TRUE;
+}
+
+
 int
 UnSetRangeBV(BitVector *bv, int start, int len)
 {
-    int i,j,k;
-    
     if (start < 0 || len < 0 || start+len > bv->numbits)
         return FALSE;
     
     bv->next_free = start;
-    
-    for(k=start; k < start+len; k++) {
-        i = k / BITS_IN_CHUNK; /* i == index to bv->bits         */
-        j = k % BITS_IN_CHUNK; /* j == bit inside of bv->bits[i] */
-     
-        bv->bits[i] &= ~(1 << j);
-    }     
+
+    if (len > 0)
+        change_range(bv, start, len, 0);
     
     return TRUE;
 }
@@ -105,7 +195,315 @@ IsSetBV(BitVector *bv, int which)
     i = which / BITS_IN_CHUNK;
     j = which % BITS_IN_CHUNK;
     
-    return (int)(bv->bits[i] & (1 << j));
+    return ((uint32)bv->bits[i] & (1U << j)) != 0;
+}
+
+
+/*
+  fetch 64-bit word w.  bits past the end of the vector read as set
+  so that nothing ever gets allocated out there.
+*/
+static bvword
+load_word(BitVector *bv, int w)
+{
+    int    i = w * 2, nchunks, extra;
+    bvword word;
+
+    nchunks = (bv->numbits + BITS_IN_CHUNK - 1) / BITS_IN_CHUNK;
+
+    word = (uint32)bv->bits[i];
+    if (i + 1 < nchunks)
+        word |= (bvword)(uint32)bv->bits[i+1] << 32;
+    else
+        word |= ALL_ONES << 32;
+
+    extra = bv->numbits - w * BITS_IN_WORD;
+    if (extra < BITS_IN_WORD)
+        word |= ALL_ONES << extra;
+
+    return word;
+}
+
+
+/*
+  return the first word in [w, end) that isn't completely full (or,
+  if want_full is zero, completely empty), or end if there isn't one.
+  with sse2 we compare two words at a time.
+*/
+static int
+skip_words(BitVector *bv, int w, int end, int want_full)
+{
+    bvword match = want_full ? ALL_ONES : 0;
+#ifdef __SSE2__
+    int     whole = bv->numbits / BITS_IN_WORD;   /* words with no tail */
+    __m128i pattern = want_full ? _mm_set1_epi32(-1) : _mm_setzero_si128();
+    __m128i v;
+
+    if (end < whole)
+        whole = end;
+
+    while (w + 2 <= whole) {
+        v = _mm_loadu_si128((__m128i *)&bv->bits[w * 2]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, pattern)) != 0xffff)
+            break;
+        w += 2;
+    }
+#endif
+
+    while (w < end && load_word(bv, w) == match)
+        w++;
+
+    return w;
+}
+
+
+/*
+  return a word with bit i set if bits i through i+n-1 of z are all
+  set.  each step doubles the run length we've checked for so this
+  takes log2(n) shifts instead of n.
+*/
+static bvword
+runs_of(bvword z, int n)
+{
+    int r = 1, s;
+
+    while (r < n && z) {
+        s  = (r < n - r) ? r : n - r;
+        z &= z >> s;
+        r += s;
+    }
+
+    return z;
+}
+
+
+/* the length of the longest run of set bits in z, if it's more than min */
+static int
+longest_run(bvword z, int min)
+{
+    bvword m;
+    int    n;
+
+    if (min >= BITS_IN_WORD || (m = runs_of(z, min + 1)) == 0)
+        return min;
+
+    for(n = min + 1; (m &= m >> 1) != 0; n++)
+        ;
+
+    return n;
+}
+
+
+/*
+  look for len clear bits in a row starting at or after pos.  we stop
+  looking once we pass limit (a run already in progress can go past it).
+  *max_free tracks the longest run we saw (never more than len).
+
+  each word is handled as a whole: its low clear bits extend the run
+  carried in from the previous word, runs_of() finds any run that fits
+  inside the word and its high clear bits start the next carried run.
+  full and empty words are skipped in bulk.
+*/
+static int
+find_free_run(BitVector *bv, int pos, int limit, int len, int *max_free)
+{
+    int    w, w2, nwords, lend, lead, trail, n;
+    int    run_start = 0, run_len = 0;
+    bvword word, z, m;
+
+    nwords = (bv->numbits + BITS_IN_WORD - 1) / BITS_IN_WORD;
+    lend   = (limit + BITS_IN_WORD - 1) / BITS_IN_WORD;
+    w      = pos / BITS_IN_WORD;
+    word   = load_word(bv, w) | ~(ALL_ONES << (pos % BITS_IN_WORD));
+
+    for(;;) {
+        if (word == ALL_ONES) {
+            if (run_len > *max_free)
+                *max_free = (run_len < len) ? run_len : len;
+            run_len = 0;
+
+            w = skip_words(bv, w + 1, lend, 1);
+        } else if (word == 0) {
+            if (run_len == 0)
+                run_start = w * BITS_IN_WORD;
+
+            w2 = skip_words(bv, w + 1, nwords, 0);
+            run_len += (w2 - w) * BITS_IN_WORD;
+            if (run_len >= len)
+                return run_start;
+
+            w = w2;
+        } else {
+            lead = ctz64(word);
+            if (run_len + lead >= len)
+                return run_len ? run_start : w * BITS_IN_WORD;
+
+            run_len += lead;
+            if (run_len > *max_free)
+                *max_free = run_len;
+
+            z = ~word;
+            if (len <= BITS_IN_WORD && (m = runs_of(z, len)) != 0)
+                return w * BITS_IN_WORD + ctz64(m);
+
+            /* see if there's a longer run inside this word than before */
+            if (*max_free < len) {
+                n = longest_run(z, *max_free);
+                *max_free = (n < len) ? n : len;
+            }
+
+            trail     = clz64(word);
+            run_len   = trail;
+            run_start = (w + 1) * BITS_IN_WORD - trail;
+
+            w++;
+        }
+
+        if (w >= nwords || (run_len == 0 && w * BITS_IN_WORD >= limit))
+            break;
+
+        word = load_word(bv, w);
+    }
+
+    if (run_len > *max_free)
+        *max_free = (run_len < len) ? run_len : len;
+
+    return -1;
+}
+
+
+/*
+  Find the first range of len clear bits that starts in [start, limit)
+  without setting them.  The range itself may run past limit.
+
+  returns: the number of the first free bit or -1 on failure
+*/
+int
+FindFreeRangeBV(BitVector *bv, int start, int limit, int len)
+{
+    int max_free = 0, pos;
+
+    if (limit > bv->numbits)
+        limit = bv->numbits;
+
+    if (len <= 0 || start < 0 || start >= limit)
+        return -1;
+
+    /*
+       find_free_run() only stops at word boundaries so what it finds
+       can start past limit.  it finds the first run there is so if
+       that one is too far along, there isn't one.
+    */
+    pos = find_free_run(bv, start, limit, len, &max_free);
+    if (pos >= limit)
+        return -1;
+
+    return pos;
+}
+
+
+/*
+  Summarize len bits starting at start: how many are clear, the longest
+  run of clear bits and the clear runs touching either end.  start and
+  len must be multiples of 64; bits past the end of the vector count as
+  set.
+*/
+void
+SummarizeBV(BitVector *bv, int start, int len, BVRange *r)
+{
+    int    w, end, run = 0, lead;
+    bvword word;
+
+    r->free    = 0;
+    r->longest = 0;
+    r->head    = -1;
+
+    end = (start + len) / BITS_IN_WORD;
+    for(w=start / BITS_IN_WORD; w < end; w++) {
+        if (w * BITS_IN_WORD >= bv->numbits)
+            word = ALL_ONES;
+        else
+            word = load_word(bv, w);
+
+        if (word == 0) {
+            r->free += BITS_IN_WORD;
+            run     += BITS_IN_WORD;
+            continue;
+        }
+
+        r->free += BITS_IN_WORD - popcount64(word);
+
+        lead = ctz64(word);
+        run += lead;
+        if (r->head < 0)
+            r->head = run;
+        if (run > r->longest)
+            r->longest = run;
+
+        r->longest = longest_run(~word, r->longest);
+        run = clz64(word);
+    }
+
+    if (r->head < 0)            /* the whole range is clear */
+        r->head = run;
+    if (run > r->longest)
+        r->longest = run;
+    r->tail = run;
+}
+
+
+/*
+  Find the first run of clear bits at or after pos.
+
+  returns: the number of the first bit in the run (its length goes in
+           *len) or -1 if there are no clear bits left
+*/
+int
+NextFreeRunBV(BitVector *bv, int pos, int *len)
+{
+    int    w, nwords, start, end;
+    bvword word;
+
+    start = FindFreeRangeBV(bv, pos, bv->numbits, 1);
+    if (start == -1)
+        return -1;
+
+    nwords = (bv->numbits + BITS_IN_WORD - 1) / BITS_IN_WORD;
+    w      = start / BITS_IN_WORD;
+    word   = load_word(bv, w) & (ALL_ONES << (start % BITS_IN_WORD));
+
+    while (word == 0) {
+        w = skip_words(bv, w + 1, nwords, 0);
+        if (w >= nwords)
+            break;
+        word = load_word(bv, w);
+    }
+
+    if (w >= nwords)
+        end = bv->numbits;
+    else
+        end = w * BITS_IN_WORD + ctz64(word);
+
+    if (end > bv->numbits)
+        end = bv->numbits;
+
+    *len = end - start;
+    return start;
+}
+
+
+/* Count the number of set bits in a bit vector */
+int
+CountBitsBV(BitVector *bv)
+{
+    int w, nwords, count = 0;
+    int tail = (-bv->numbits) & (BITS_IN_WORD - 1);
+
+    nwords = (bv->numbits + BITS_IN_WORD - 1) / BITS_IN_WORD;
+    for(w=0; w < nwords; w++)
+        count += popcount64(load_word(bv, w));
+
+    return count - tail;    /* load_word() pads the tail with ones */
 }
 
 
@@ -116,116 +514,43 @@ IsSetBV(BitVector *bv, int which)
  *
  *   returns: the number of the first free bit or -1 on failure
  *
+ *   The search starts at the word holding next_free and wraps around
+ *   to the beginning; a range never wraps past the end of the vector.
  */
 int
 GetFreeRangeOfBits(BitVector *bv, int len, int *biggest_free_chunk)
 {
-    int max_free = -1;
-    int i,j,k,n, begin, base, real_count;
-    int count, start, bit, non_zero_bits=0;
+    int max_free = 0, base, start;
   
     if (biggest_free_chunk)
         *biggest_free_chunk = -1;
 
     if (len <= 0 || len > bv->numbits || bv->is_full)
         return -1;
-    
-    count = bv->numbits / BITS_IN_CHUNK;
-    if ((bv->numbits % BITS_IN_CHUNK) != 0)
-        count++;
-    
-    base = bv->next_free / BITS_IN_CHUNK;
-  
-    for(i=0, real_count=0; i < count; i++, real_count++) {
-        if (real_count > count)
-            panic("bitmap loop! count %d, real_count %d, i %d bv @ 0x%lx\n",
-                  count, real_count, i, (ulong)bv);
 
-        begin = (base + i) % count;
+    base = bv->next_free;
+    if (base < 0 || base >= bv->numbits)
+        base = 0;
+    base -= base % BITS_IN_WORD;
 
-        if (bv->bits[begin] == (chunk)(~0)) {
-            non_zero_bits += sizeof(chunk) * CHAR_BIT;
-            continue;
-        }
-     
-        for(j=0; j < BITS_IN_CHUNK; j++) {
-            if ((bv->bits[begin] & (1 << j)) != 0) {
-                non_zero_bits++;
-            } else {                                   /* aha! a free bit */
-                start = (begin * BITS_IN_CHUNK) + j; 
-                bit = j;  n = begin;
-       
-                /*
-                 * Here we start to see if we can get a range of bits,
-                 * being careful if we cross chunk boundaries.
-                 */
-                for(k=0; k < len && (n*BITS_IN_CHUNK+bit) < bv->numbits; k++,bit++) {
-                    if (((bv->bits[n]) & (1 << bit)) != 0)
-                        break;
-          
-                    if ((bit+1) == BITS_IN_CHUNK) {
-                        n++;
-                        bit = -1;  /* gets incremented on loop continuation */
-                    }
-                }
-
-                if (k > max_free) {
-                    max_free = k;
-                }
-
-                if ((n*BITS_IN_CHUNK+bit) >= bv->numbits && k < len) {
-                    /* i += (n - begin - 1); */
-                    if (n > begin)
-                        i += (n - begin);
-                    else
-                        i += 1;
-                    break;
-                }
-
-                if (k < len) { /* didn't find a big enough range here */
-                    i += (n - begin); /* advance over what we just checked */
-                    begin = n;
-                    j = bit;
-                    continue;
-                }
-
-                if ((begin*BITS_IN_CHUNK+j + len) > bv->numbits) 
-                    break;      /* too big for the # of bits */
-
-                /*
-                 * Now go back through and set all the bits
-                 */
-                bit = j; n = begin;
-                for(k=0; k < len; k++, bit++) {
-                    bv->bits[n] |= (1 << bit);
-          
-                    if ((bit+1) == BITS_IN_CHUNK) {
-                        n++;
-                        bit = -1;  /* gets incremented on loop continuation */
-                    }
-                }
-
-                if (n < count) {
-                    if ((bv->bits[n] & (1 << bit)) == 0)
-                        bv->next_free = start + len;
-                }
-
-                return (start);
-            }  /* end of if (...) aha! a free bit */
-            
-        }  /* end of for(j=0; ...) (loop on each bit) */
-        
-    }  /* end of for(i=0; ...) (loop on each chunk) */
-
-
-    if (non_zero_bits >= bv->numbits)  /* then mark this guy as full */
-        bv->is_full = 1;
+    start = find_free_run(bv, base, bv->numbits, len, &max_free);
+    if (start == -1 && base > 0)
+        start = find_free_run(bv, 0, base, len, &max_free);
 
-    if (biggest_free_chunk)
-        *biggest_free_chunk = max_free;
+    if (start == -1) {
+        if (max_free == 0)          /* we looked at every bit */
+            bv->is_full = 1;
 
+        if (biggest_free_chunk)
+            *biggest_free_chunk = max_free;
 
-    /* if we get here, we didn't find nuthin. */
-    return -1;
-}
+        return -1;
+    }
+
+    change_range(bv, start, len, 1);
 
+    if (start + len < bv->numbits && IsSetBV(bv, start + len) == 0)
+        bv->next_free = start + len;
+
+    return start;
+}
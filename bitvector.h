@@ -15,11 +15,25 @@ typedef struct BitVector
   chunk *bits;            /* the actual bitmap */
 } BitVector;
 
+/* a summary of a range of bits, filled in by SummarizeBV() */
+typedef struct BVRange
+{
+  int    free;            /* number of clear bits in the range */
+  int    longest;         /* longest run of clear bits */
+  int    head;            /* clear bits at the start of the range */
+  int    tail;            /* clear bits at the end of the range */
+} BVRange;
+
 /* prototypes */
 int  SetBV(BitVector *bv, int which);
 int  UnSetBV(BitVector *bv, int which);
+int  SetRangeBV(BitVector *bv, int start, int len);
 int  UnSetRangeBV(BitVector *bv, int lo, int hi);
 int  IsSetBV(BitVector *bv, int which);
 int  GetFreeRangeOfBits(BitVector *bv, int len, int *biggest_free_chunk);
+int  FindFreeRangeBV(BitVector *bv, int start, int limit, int len);
+int  NextFreeRunBV(BitVector *bv, int pos, int *len);
+void SummarizeBV(BitVector *bv, int start, int len, BVRange *r);
+int  CountBitsBV(BitVector *bv);
 
 #endif /* _BIT_VECTOR_H */
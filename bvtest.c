@@ -0,0 +1,152 @@
+/*
+  This file checks the bit vector searches in bitvector.c against a
+  simple bit at a time version of the same thing.  "make test" runs it.
+
+  Usage:  bvtest [iterations]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+#include "bitvector.h"
+
+
+static int
+is_set(BitVector *bv, int i)
+{
+    return ((unsigned)bv->bits[i / BITS_IN_CHUNK] >> (i % BITS_IN_CHUNK)) & 1;
+}
+
+
+/* the first len clear bits in a row that start in [start, limit) */
+static int
+ref_find_free_range(BitVector *bv, int start, int limit, int len)
+{
+    int s, n;
+
+    if (limit > bv->numbits)
+        limit = bv->numbits;
+
+    for(s=start; s < limit; s++) {
+        for(n=0; n < len && s + n < bv->numbits && !is_set(bv, s + n); n++)
+            ;
+        if (n == len)
+            return s;
+    }
+
+    return -1;
+}
+
+
+static int
+check(BitVector *bv, int start, int limit, int len)
+{
+    int got, want;
+
+    got  = FindFreeRangeBV(bv, start, limit, len);
+    want = ref_find_free_range(bv, start, limit, len);
+    if (got == want)
+        return 0;
+
+    printf("FindFreeRangeBV: numbits %d start %d limit %d len %d: "
+           "got %d, expected %d\n", bv->numbits, start, limit, len, got,
+           want);
+    return 1;
+}
+
+
+static BitVector *
+new_bv(int numbits)
+{
+    BitVector *bv;
+
+    bv = (BitVector *)calloc(1, sizeof(BitVector));
+    /* the searches read whole 64-bit words */
+    bv->bits    = (chunk *)calloc((numbits + 63) / 64 * 2, sizeof(chunk));
+    bv->numbits = numbits;
+
+    return bv;
+}
+
+
+static void
+free_bv(BitVector *bv)
+{
+    free(bv->bits);
+    free(bv);
+}
+
+
+/*
+  a run that only starts after limit, once the word limit is in runs
+  out: 107..128 are used and 129..139 are free.
+*/
+static int
+limit_mid_word(void)
+{
+    BitVector *bv = new_bv(140);
+    int        errors;
+
+    SetRangeBV(bv, 0, 129);
+    errors  = check(bv, 107, 128, 3);
+    errors += check(bv, 107, 129, 3);
+    errors += check(bv, 107, 130, 3);
+
+    /* the same with the run carried in from the word before */
+    UnSetRangeBV(bv, 0, 140);
+    SetRangeBV(bv, 0, 60);
+    SetRangeBV(bv, 66, 4);
+    errors += check(bv, 10, 62, 8);
+    errors += check(bv, 10, 70, 8);
+
+    free_bv(bv);
+
+    return errors;
+}
+
+
+static int
+random_ranges(int iterations)
+{
+    BitVector *bv;
+    int        i, t, nbits, density, start, limit, len, errors = 0;
+
+    srand(1);
+    for(t=0; t < iterations && errors < 10; t++) {
+        nbits   = 1 + rand() % 700;
+        density = rand() % 100;
+
+        bv = new_bv(nbits);
+        for(i=0; i < nbits; i++)
+            if (rand() % 100 < density)
+                SetBV(bv, i);
+
+        start = rand() % nbits;
+        limit = start + 1 + rand() % (nbits - start + 8);
+        len   = 1 + rand() % ((rand() & 1) ? 8 : 80);
+
+        errors += check(bv, start, limit, len);
+
+        free_bv(bv);
+    }
+
+    return errors;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    int iterations = 100000, errors;
+
+    if (argc > 1)
+        iterations = strtol(argv[1], NULL, 0);
+
+    errors  = limit_mid_word();
+    errors += random_ranges(iterations);
+
+    printf("bvtest: %d errors\n", errors);
+
+    return errors ? 1 : 0;
+}
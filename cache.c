@@ -2314,6 +2314,35 @@ get_block(int dev, fs_off_t bnum, int bsize)
     return data;
 }
 
+/*
+  bring blocks bnum..bnum+nblocks-1 into the cache before anyone asks
+  for them.  each one that's missing is read along with the blocks after
+  it (the read-ahead in cache_block_io()) so this comes down to a few
+  large reads.  returns how many reads it took.
+*/
+int
+prefetch_blocks(int dev, fs_off_t bnum, int nblocks, int bsize)
+{
+    int    i, nreads = 0;
+    void  *ce;
+
+    for(i=0; i < nblocks; i++) {
+        LOCK(bc.lock);
+        ce = hash_lookup(&bc.ht, dev, bnum + i);
+        UNLOCK(bc.lock);
+
+        if (ce)
+            continue;
+
+        if (get_block(dev, bnum + i, bsize) == NULL)
+            break;
+        release_block(dev, bnum + i);
+        nreads++;
+    }
+
+    return nreads;
+}
+
 void *
 get_empty_block(int dev, fs_off_t bnum, int bsize)
 {
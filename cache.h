@@ -77,6 +77,7 @@ extern  int   remove_cached_device_blocks(int dev, int allow_write);
 
 extern  void *get_block(int dev, fs_off_t bnum, int bsize);
 extern  void *get_empty_block(int dev, fs_off_t bnum, int bsize);
+extern  int   prefetch_blocks(int dev, fs_off_t bnum, int nblocks, int bsize);
 extern  int   release_block(int dev, fs_off_t bnum);
 extern  int   mark_blocks_dirty(int dev, fs_off_t bnum, int nblocks);
 
@@ -23,6 +23,7 @@
 
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <errno.h>
 #include <memory.h>
@@ -105,6 +106,21 @@ struct my_stat {
     time_t          crtime;     /* creation time; not posix but useful */
 };
 
+/*
+  readdirplus() hands back a stat of each entry along with its name.
+  d_ent.d_reclen is the size of the whole record, stat included.  an
+  entry that couldn't be stat'ed still comes back, with d_stat zeroed
+  (so d_stat.ino is 0).
+*/
+typedef struct my_direntplus {
+    struct my_stat      d_stat;
+    struct my_dirent    d_ent;
+} my_direntplus_t;
+
+/* modes for fallocate() */
+#define     MY_FALLOC_KEEP_SIZE   0x0001  /* leave the file size alone */
+#define     MY_FALLOC_UNWRITTEN   0x0002  /* don't zero the blocks on disk */
+
 
 #define     MY_S_IFMT        00000170000 /* type of file */
 #define     MY_S_IFLNK       00000120000 /* symbolic link */
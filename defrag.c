@@ -0,0 +1,75 @@
+/*
+  This file contains a defragmenter.  It mounts the file system, reports
+  how many extents each file is in and how fragmented the free space is,
+  and then rewrites every fragmented file into a single run of blocks
+  while the volume stays mounted.  See frag.c for how.
+
+  Usage:  defrag [-n] [-v] [disk_name]
+
+          -n  only report, don't move anything
+          -v  print a line for every file
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "myfs.h"
+#include "kprotos.h"
+#include "initfs.h"
+#include "frag.h"
+
+
+int
+main(int argc, char **argv)
+{
+    int             i, flags = FRAG_MOVE;
+    char           *disk_name = "big_file";
+    myfs_info      *myfs;
+    frag_stats      st;
+    struct timeval  start, end;
+
+    for(i=1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0)
+            flags &= ~FRAG_MOVE;
+        else if (strcmp(argv[i], "-v") == 0)
+            flags |= FRAG_VERBOSE;
+        else
+            disk_name = argv[i];
+    }
+
+    myfs = init_fs(disk_name);
+
+    /* blocks held in reservation windows would look like used space */
+    myfs_release_all_windows(myfs);
+
+    printf("free space before:\n");
+    frag_print_free_space(myfs);
+
+    if (flags & FRAG_VERBOSE)
+        printf("   inode       size  extents\n");
+
+    memset(&st, 0, sizeof(st));
+    gettimeofday(&start, NULL);
+    frag_walk("/myfs", flags, &st);
+    sys_sync();
+    gettimeofday(&end, NULL);
+
+    frag_print_stats(&st);
+
+    if (flags & FRAG_MOVE) {
+        printf("took %ld ms\n", (end.tv_sec - start.tv_sec) * 1000 +
+               (end.tv_usec - start.tv_usec) / 1000);
+        printf("free space after:\n");
+        frag_print_free_space(myfs);
+    }
+
+    if (sys_unmount(1, -1, "/myfs") != 0) {
+        printf("could not un-mount /myfs\n");
+        return 5;
+    }
+
+    shutdown_block_cache();
+
+    return 0;
+}
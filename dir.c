@@ -44,12 +44,10 @@ make_dir(myfs_info *myfs, myfs_inode *parent, int mode, myfs_inode **newdir)
     /* force mde to start on an 8-byte boundary */
     start = mde = (myfs_dirent *)(((ulong)&buff[0] + 7) & ~7);
 
-    mi = myfs_allocate_inode(myfs, parent, mode);
+    mi = myfs_allocate_inode(myfs, parent, mode | MY_S_IFDIR);
     if (mi == NULL)
         return ENOSPC;
 
-    mi->mode |= MY_S_IFDIR;            /* mark it as a directory */
-
     mde->inum     = mi->inode_num;
     mde->name_len = 1;
     strcpy(&mde->name[0], ".");
@@ -68,6 +66,7 @@ make_dir(myfs_info *myfs, myfs_inode *parent, int mode, myfs_inode **newdir)
     ret = myfs_write_data_stream(myfs, mi, 0, (const char *)start, &len);
     if (ret != 0 || len != ((ulong)mde - (ulong)start)) {
         myfs_free_inode(myfs, mi->inode_num);
+        myfs_put_inode(myfs, mi);
         if (ret == 0)
             ret = ENOSPC;
         return ret;
@@ -299,12 +298,8 @@ myfs_mkdir(void *ns, void *parent_dir, const char *name, int mode)
         myfs_free_inode(myfs, mi->inode_num);
     }
 
-    /* free this stuff because we didn't call new_vnode() on it */
-    free_lock(&mi->etc->lock);
-    free(mi->etc);
-    mi->etc = NULL;
-    
-    free(mi);
+    /* give it back because we didn't call new_vnode() on it */
+    myfs_put_inode(myfs, mi);
         
     return ret;
 }
@@ -421,55 +416,217 @@ myfs_rewinddir(void *ns, void *dir, void *cookie)
     return 0;
 }
 
+/*
+  if the directory changed since the cookie was last used then its
+  curptr may point into a stale contents buffer.  re-walk the new
+  contents to find our place again.
+*/
+static void
+resync_dir_cookie(myfs_inode *mi, dir_cookie *dc)
+{
+    int          i;
+    myfs_dirent *mde, *end;
+
+    if (dc->counter == mi->etc->counter)
+        return;
+
+    mde = (myfs_dirent *)mi->etc->contents;
+    end = (myfs_dirent *)((char *)mi->etc->contents + mi->data.size);
+
+    for(i=0; i < dc->index-1 && mde < end; i++) {
+        mde = NEXT_MDE(mde);
+    }
+
+    dc->curptr  = (char *)mde;
+    dc->counter = mi->etc->counter;
+    dc->index--;
+}
+
+
+/*
+  copy out as many entries as the caller asked for and as will fit in
+  their buffer.  each record has "hdr" bytes in front of its my_dirent
+  (readdirplus puts a my_stat there) and d_reclen is the size of the
+  whole record rounded up to keep the next one aligned, the same as
+  the root file system does it.
+*/
+static int
+copy_dirents(myfs_info *myfs, myfs_inode *mi, dir_cookie *dc, long *num,
+             char *buf, size_t bufsize, size_t hdr)
+{
+    long              i;
+    size_t            rl;
+    myfs_dirent      *mde;
+    struct my_dirent *de;
+    char             *p, *e, *end;
+
+    if (mi->etc->contents == NULL) {     /* nothing in the directory */
+        *num = 0;
+        return 0;
+    }
+
+    resync_dir_cookie(mi, dc);
+
+    p   = buf;
+    e   = buf + bufsize;
+    end = mi->etc->contents + mi->data.size;
+    for(i=0; i < *num && dc->curptr < end; i++) {
+        mde = (myfs_dirent *)dc->curptr;
+
+        rl = hdr + sizeof(struct my_dirent) + mde->name_len;
+        if (p + rl > e)
+            break;
+
+        de = (struct my_dirent *)(p + hdr);
+        de->d_dev    = myfs->fd;
+        de->d_ino    = mde->inum;
+        de->d_reclen = (rl + 7) & ~7;
+        memcpy(&de->d_name[0], mde->name, mde->name_len+1);
+
+        p += de->d_reclen;
+
+        dc->curptr = (char *)NEXT_MDE(mde);
+        dc->index++;
+    }
+
+    if (i == 0 && *num > 0 && dc->curptr < end)  /* buffer is too small */
+        return EINVAL;
+
+    *num = i;
+    return 0;
+}
+
+
 int
 myfs_readdir(void *ns, void *dir, void *cookie, long *num,
              struct my_dirent *buf, size_t bufsize)
 {
-    int          i;
     myfs_info   *myfs = (myfs_info *)ns;
     myfs_inode  *mi   = (myfs_inode *)dir;
     dir_cookie  *dc   = (dir_cookie *)cookie;
-    myfs_dirent *mde, *end;
 
     CHECK_INODE(mi);
 
-    if (mi->etc->contents == NULL) {     /* nothing in the directory */
-        *num = 0;
-        return 0;
-    }
+    return copy_dirents(myfs, mi, dc, num, (char *)buf, bufsize, 0);
+}
 
-    if (dc->counter != mi->etc->counter) {      /* then we have to re-sync */
-        dc->curptr = mi->etc->contents;
-        mde = (myfs_dirent *)mi->etc->contents;
-        end = (myfs_dirent *)((char *)mi->etc->contents + mi->data.size);
 
-        for(i=0; i < dc->index-1 && mde < end; i++) {
-            mde = NEXT_MDE(mde);
-        }
+static int
+compare_dplus_inum(const void *a, const void *b)
+{
+    const struct my_direntplus *da = *(const struct my_direntplus **)a;
+    const struct my_direntplus *db = *(const struct my_direntplus **)b;
+
+    if (da->d_ent.d_ino < db->d_ent.d_ino)
+        return -1;
+    else if (da->d_ent.d_ino > db->d_ent.d_ino)
+        return 1;
 
-        dc->curptr  = (char *)mde;
-        dc->counter = mi->etc->counter;
-        dc->index--;
+    return 0;
+}
+
+/*
+  an entry whose inode we couldn't load or stat goes back with its
+  d_stat zeroed instead of failing the whole call.  otherwise every
+  later call would trip over the same entry and nothing past it could
+  ever be listed.
+*/
+static void
+stat_dirplus(myfs_info *myfs, myfs_inode *mi, struct my_direntplus *dp)
+{
+    if (mi == NULL || myfs_rstat(myfs, mi, &dp->d_stat) != 0)
+        memset(&dp->d_stat, 0, sizeof(dp->d_stat));
+}
+
+/*
+  readdirplus is readdir plus a stat of each entry.  we fill in the
+  names first and then load the inodes sorted by inode number, one
+  get_vnodes() call per DIRPLUS_BATCH of them, so the entries which
+  share an inode table block are decoded from it in one pass instead of
+  bouncing around the table.  the batches keep us from holding too many
+  vnodes at once.  if a batch won't load we go back through it one
+  vnode at a time so only the bad ones lose their stat.
+*/
+#define DIRPLUS_BATCH  32
+
+int
+myfs_readdirplus(void *ns, void *dir, void *cookie, long *num,
+                 struct my_direntplus *buf, size_t bufsize)
+{
+    int                    err = 0;
+    long                   i, j, cnt, n;
+    myfs_info             *myfs = (myfs_info *)ns;
+    myfs_inode            *mi   = (myfs_inode *)dir;
+    dir_cookie            *dc   = (dir_cookie *)cookie, start;
+    myfs_inode           **ino;
+    vnode_id              *vnids;
+    struct my_direntplus **order;
+    struct my_direntplus  *p;
+
+    CHECK_INODE(mi);
+
+    if (mi->etc->contents != NULL)
+        resync_dir_cookie(mi, dc);
+    start = *dc;
+
+    n = *num;
+    err = copy_dirents(myfs, mi, dc, &n, (char *)buf, bufsize,
+                       offsetof(struct my_direntplus, d_ent));
+    if (err != 0 || n == 0) {
+        *num = n;
+        return err;
     }
 
-    /* check if we're at the end of the directory */
-    if (dc->curptr >= (mi->etc->contents + mi->data.size)) { 
-        *num = 0;
-        return 0;
+    order = (struct my_direntplus **)malloc(n * sizeof(*order));
+    vnids = (vnode_id *)malloc(n * sizeof(vnode_id));
+    ino   = (myfs_inode **)malloc(DIRPLUS_BATCH * sizeof(myfs_inode *));
+    if (order == NULL || vnids == NULL || ino == NULL) {
+        *dc = start;               /* so the caller can try them again */
+        n   = 0;
+        err = ENOMEM;
+        goto out;
     }
-    
-    mde = (myfs_dirent *)dc->curptr;
-    buf->d_dev    = myfs->fd;
-    buf->d_ino    = mde->inum;
-    buf->d_reclen = mde->name_len;
-    memcpy(&buf->d_name[0], mde->name, mde->name_len+1);
 
-    *num = 1;
+    p = buf;
+    for(i=0; i < n; i++) {
+        order[i] = p;
+        p = (struct my_direntplus *)((char *)p + p->d_ent.d_reclen);
+    }
 
-    mde = NEXT_MDE(mde);
+    qsort(order, n, sizeof(*order), compare_dplus_inum);
 
-    dc->curptr = (char *)mde;
-    dc->index++;
-    
-    return 0;
+    for(i=0; i < n; i++)
+        vnids[i] = order[i]->d_ent.d_ino;
+
+    for(i=0; i < n; i += cnt) {
+        cnt = (n - i < DIRPLUS_BATCH) ? n - i : DIRPLUS_BATCH;
+
+        if (get_vnodes(myfs->nsid, &vnids[i], cnt, (void **)ino) == 0) {
+            for(j=0; j < cnt; j++) {
+                stat_dirplus(myfs, ino[j], order[i+j]);
+                put_vnode(myfs->nsid, vnids[i+j]);
+            }
+            continue;
+        }
+
+        for(j=0; j < cnt; j++) {
+            if (get_vnode(myfs->nsid, vnids[i+j], (void **)&ino[j]) != 0) {
+                stat_dirplus(myfs, NULL, order[i+j]);
+                continue;
+            }
+            stat_dirplus(myfs, ino[j], order[i+j]);
+            put_vnode(myfs->nsid, vnids[i+j]);
+        }
+    }
+
+ out:
+    if (order)
+        free(order);
+    if (vnids)
+        free(vnids);
+    if (ino)
+        free(ino);
+
+    *num = n;
+    return err;
 }
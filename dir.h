@@ -7,6 +7,8 @@ int myfs_free_dircookie(void *ns, void *node, void *cookie);
 int myfs_rewinddir(void *ns, void *node, void *cookie);
 int myfs_readdir(void *ns, void *node, void *cookie, long *num,
                  struct my_dirent *buf, size_t bufsize);
+int myfs_readdirplus(void *ns, void *node, void *cookie, long *num,
+                     struct my_direntplus *buf, size_t bufsize);
 int myfs_walk(void *ns, void *base, const char *file, char **newpath,
               vnode_id *vnid);
 
@@ -35,19 +35,126 @@ myfs_init_data_stream(myfs_info *myfs, myfs_inode *mi)
 
 
 
+/*
+  each inode remembers the last few runs of blocks that mapping a file
+  position turned up (etc->map) so that walking through a file doesn't
+  read its indirect block, or search its extents, for every block.
+  whatever changes the mapping has to call map_cache_invalidate().
+*/
 static fs_off_t
-file_pos_to_disk_addr(myfs_info *myfs, myfs_inode *mi, fs_off_t pos)
+map_cache_lookup(myfs_info *myfs, myfs_inode *mi, fs_off_t lblock)
+{
+    int        i;
+    block_map *m = mi->etc->map;
+
+    for(i=0; i < mi->etc->map_count; i++, m++) {
+        if (lblock >= m->lblock && lblock < m->lblock + m->len) {
+            myfs->map_hits++;
+            return m->entry + (lblock - m->lblock);
+        }
+    }
+
+    return 0;
+}
+
+/*
+  cache the runs in n block pointers for the blocks from lblock on.
+  it stops at a hole or a pointer that's out of range; the lookup
+  that gets there will complain about it.
+*/
+static void
+map_cache_fill(myfs_info *myfs, myfs_inode *mi, fs_off_t lblock,
+               fs_off_t *ptrs, int n)
+{
+    int             i;
+    myfs_inode_etc *etc = mi->etc;
+    block_map      *m = NULL;
+
+    myfs->map_misses++;
+    etc->map_count = 0;
+
+    for(i=0; i < n; i++) {
+        if (ptrs[i] <= 0 || BLOCK_ADDR(ptrs[i]) > myfs->dsb.num_blocks)
+            break;
+
+        if (m && ptrs[i] == m->entry + m->len) {
+            m->len++;
+            continue;
+        }
+
+        if (etc->map_count == MAP_CACHE_RUNS)
+            break;
+
+        m = &etc->map[etc->map_count++];
+        m->lblock = lblock + i;
+        m->entry  = ptrs[i];
+        m->len    = 1;
+    }
+}
+
+static void
+map_cache_invalidate(myfs_inode *mi)
+{
+    mi->etc->map_count = 0;
+}
+
+
+/* file_pos_to_entry() for a file mapped by extents (see extent.c) */
+static fs_off_t
+extent_pos_to_entry(myfs_info *myfs, myfs_inode *mi, fs_off_t pos)
+{
+    fs_off_t     lblock = pos / myfs->dsb.block_size, addr;
+    file_extent  e;
+    block_map   *m = mi->etc->map;
+
+    if (extent_lookup(myfs, &mi->data, lblock, &e) == 0)
+        return 0;
+
+    addr = e.pblock + (lblock - e.lblock);
+    if (addr <= 0 || addr > myfs->dsb.num_blocks) {
+        myfs_die("file_pos:2: addr 0x%lx is out of range (max %ld)\n",
+                 addr, myfs->dsb.num_blocks);
+    }
+
+    if (e.len & EXTENT_UNWRITTEN)
+        addr |= UNWRITTEN_BLOCK;
+
+    /* the extent is the run */
+    myfs->map_misses++;
+    m->lblock = e.lblock;
+    m->len    = EXT_LEN(&e);
+    m->entry  = addr - (lblock - e.lblock);
+    mi->etc->map_count = 1;
+
+    return addr;
+}
+
+
+/*
+  return the block pointer that maps pos, UNWRITTEN_BLOCK bit and all.
+  file_pos_to_disk_addr() below is the same thing without the bit.
+*/
+static fs_off_t
+file_pos_to_entry(myfs_info *myfs, myfs_inode *mi, fs_off_t pos)
 {
     int       bsize = myfs->dsb.block_size;
-    int       index;
+    int       index, max_index = bsize / sizeof(fs_off_t);
     fs_off_t  addr, offset, tmp;
     fs_off_t *block, *block2;
     
+    /* direct blocks are right here already */
+    if ((pos >= MAX_DIRECT_RANGE || EXTENT_MAPPED(myfs)) &&
+        (addr = map_cache_lookup(myfs, mi, pos / bsize)) != 0)
+        return addr;
+
+    if (EXTENT_MAPPED(myfs))
+        return extent_pos_to_entry(myfs, mi, pos);
+
     if (pos < NUM_DIRECT_BLOCKS*bsize) {
         index = pos / bsize;
         addr = mi->data.direct[index];
         
-        if (addr < 0 || addr > myfs->dsb.num_blocks) {
+        if (addr < 0 || BLOCK_ADDR(addr) > myfs->dsb.num_blocks) {
             myfs_die("file_pos:1: addr 0x%lx is out of range (max %ld)\n",
                      addr, myfs->dsb.num_blocks);
         }
@@ -56,11 +163,14 @@ file_pos_to_disk_addr(myfs_info *myfs, myfs_inode *mi, fs_off_t pos)
     } else if (pos < MAX_INDIRECT_RANGE) {
         block = get_block(myfs->fd, mi->data.indirect, bsize);
 
-        addr = block[(pos - MAX_DIRECT_RANGE) / bsize];
+        index = (pos - MAX_DIRECT_RANGE) / bsize;
+        addr  = block[index];
+        map_cache_fill(myfs, mi, pos / bsize, &block[index],
+                       max_index - index);
 
         release_block(myfs->fd, mi->data.indirect);
 
-        if (addr < 0 || addr > myfs->dsb.num_blocks) {
+        if (addr < 0 || BLOCK_ADDR(addr) > myfs->dsb.num_blocks) {
             myfs_die("file_pos:1: addr 0x%lx is out of range (max %ld)\n",
                      addr, myfs->dsb.num_blocks);
         }
@@ -74,14 +184,18 @@ file_pos_to_disk_addr(myfs_info *myfs, myfs_inode *mi, fs_off_t pos)
 
         tmp = addr;
         block = get_block(myfs->fd, tmp, bsize);
-        addr = block[(((pos - MAX_INDIRECT_RANGE) % INDIRECT_SIZE) / bsize)];
+        index = (((pos - MAX_INDIRECT_RANGE) % INDIRECT_SIZE) / bsize);
+        addr  = block[index];
+        map_cache_fill(myfs, mi, pos / bsize, &block[index],
+                       max_index - index);
         release_block(myfs->fd, tmp);
 
-        if (addr < 0 || addr > myfs->dsb.num_blocks) {
+        if (addr < 0 || BLOCK_ADDR(addr) > myfs->dsb.num_blocks) {
             myfs_die("file_pos:1: addr 0x%lx is out of range (max %ld)\n",
                      addr, myfs->dsb.num_blocks);
         }
         
+        return addr;
     } else {
         printf("heidy-ho... looks like it's time to implement triple "
                "indirect blocks.  have fun!\n");
@@ -91,93 +205,471 @@ file_pos_to_disk_addr(myfs_info *myfs, myfs_inode *mi, fs_off_t pos)
     return -1;
 }
 
+static fs_off_t
+file_pos_to_disk_addr(myfs_info *myfs, myfs_inode *mi, fs_off_t pos)
+{
+    fs_off_t addr;
+
+    addr = file_pos_to_entry(myfs, mi, pos);
+    if (addr < 0)
+        return addr;
+
+    return BLOCK_ADDR(addr);
+}
+
+
+/*
+  a preallocated block is about to be written: clear its UNWRITTEN_BLOCK
+  bit.  only the direct and indirect ranges can be preallocated since
+  grow_dstream() doesn't do double indirect blocks yet.  with extents
+  the unwritten extent gets split instead, which can take a tree block.
+*/
+static int
+mark_block_written(myfs_info *myfs, myfs_inode *mi, fs_off_t pos)
+{
+    int       bsize = myfs->dsb.block_size;
+    fs_off_t *block;
+
+    map_cache_invalidate(mi);
+
+    if (EXTENT_MAPPED(myfs))
+        return extent_mark_written(myfs, &mi->data, pos / bsize);
+
+    if (pos < MAX_DIRECT_RANGE) {
+        mi->data.direct[pos / bsize] &= ~UNWRITTEN_BLOCK;
+    } else if (pos < MAX_INDIRECT_RANGE) {
+        block = get_block(myfs->fd, mi->data.indirect, bsize);
+        if (block == NULL)
+            return EINVAL;
+
+        block[(pos - MAX_DIRECT_RANGE) / bsize] &= ~UNWRITTEN_BLOCK;
+
+        mark_blocks_dirty(myfs->fd, mi->data.indirect, 1);
+        release_block(myfs->fd, mi->data.indirect);
+    }
+
+    return 0;
+}
+
+
+/* does pos have a block yet?  preallocated ones can be past the eof */
+static int
+block_mapped(myfs_info *myfs, myfs_inode *mi, fs_off_t pos)
+{
+    int          bsize = myfs->dsb.block_size, mapped = 0;
+    fs_off_t    *block;
+    file_extent  e;
+
+    if (EXTENT_MAPPED(myfs))
+        return extent_lookup(myfs, &mi->data, pos / bsize, &e);
+
+    if (pos < MAX_DIRECT_RANGE)
+        return mi->data.direct[pos / bsize] != 0;
+
+    if (pos < MAX_INDIRECT_RANGE && mi->data.indirect != 0) {
+        block = get_block(myfs->fd, mi->data.indirect, bsize);
+        if (block) {
+            mapped = (block[(pos - MAX_DIRECT_RANGE) / bsize] != 0);
+            release_block(myfs->fd, mi->data.indirect);
+        }
+    }
+
+    return mapped;
+}
+
+/*
+   these two copy "amt" bytes between a block and the caller's iovecs.
+   *vec and *voff track how far into the iovec array we've gotten so
+   that a single walk of the file's blocks can fill (or drain) all of
+   the caller's buffers.  a NULL src copies zeros.
+*/
+static void
+copy_to_vecs(const struct iovec **vec, size_t *voff, const char *src,
+             size_t amt)
+{
+    size_t n;
+    
+    while(amt > 0) {
+        n = (*vec)->iov_len - *voff;
+        if (n > amt)
+            n = amt;
+
+        if (src) {
+            memcpy((char *)(*vec)->iov_base + *voff, src, n);
+            src += n;
+        } else {
+            memset((char *)(*vec)->iov_base + *voff, 0, n);
+        }
+
+        amt   -= n;
+        *voff += n;
+        if (*voff == (*vec)->iov_len) {
+            *vec  += 1;
+            *voff  = 0;
+        }
+    }
+}
+
+static void
+copy_from_vecs(const struct iovec **vec, size_t *voff, char *dst, size_t amt)
+{
+    size_t n;
+    
+    while(amt > 0) {
+        n = (*vec)->iov_len - *voff;
+        if (n > amt)
+            n = amt;
+
+        memcpy(dst, (char *)(*vec)->iov_base + *voff, n);
+
+        dst   += n;
+        amt   -= n;
+        *voff += n;
+        if (*voff == (*vec)->iov_len) {
+            *vec  += 1;
+            *voff  = 0;
+        }
+    }
+}
+
+/* step over amt bytes of the caller's iovecs, filled in some other way */
+static void
+skip_vecs(const struct iovec **vec, size_t *voff, size_t amt)
+{
+    size_t n;
+
+    while(amt > 0) {
+        n = (*vec)->iov_len - *voff;
+        if (n > amt)
+            n = amt;
+
+        amt   -= n;
+        *voff += n;
+        if (*voff == (*vec)->iov_len) {
+            *vec  += 1;
+            *voff  = 0;
+        }
+    }
+}
+
+static size_t
+total_vec_len(const struct iovec *vec, size_t count)
+{
+    size_t i, len = 0;
+
+    for(i=0; i < count; i++)
+        len += vec[i].iov_len;
+
+    return len;
+}
+
+
 int
 myfs_read_data_stream(myfs_info *myfs, myfs_inode *mi,
                            fs_off_t pos, char *buf, size_t *_len)
 {
-    int       i, offset, bsize = myfs->dsb.block_size;
-    size_t    len = *_len, amt;
-    fs_off_t  addr;
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len  = *_len;
+
+    return myfs_read_data_stream_vecs(myfs, mi, pos, &iov, 1, _len);
+}
+
+/*
+  how many of the (at most max) blocks from pos on follow addr on disk.
+  unwritten blocks and ones whose data is still in the delalloc buffer
+  don't count: their data doesn't simply go to or come from the disk.
+*/
+static fs_off_t
+contig_blocks(myfs_info *myfs, myfs_inode *mi, fs_off_t pos, fs_off_t addr,
+              fs_off_t max)
+{
+    int       bsize = myfs->dsb.block_size;
+    fs_off_t  n;
+
+    if (mi->etc->da_buf && (mi->etc->da_start - pos) / bsize < max)
+        max = (mi->etc->da_start - pos) / bsize;
+
+    for(n=1; n < max; n++)
+        if (file_pos_to_entry(myfs, mi, pos + n * bsize) != addr + n)
+            break;
+
+    return n;
+}
+
+int
+myfs_read_data_stream_vecs(myfs_info *myfs, myfs_inode *mi, fs_off_t pos,
+                           const struct iovec *vec, size_t count,
+                           size_t *_len)
+{
+    int       offset, bsize = myfs->dsb.block_size;
+    size_t    len, amt, voff = 0;
+    fs_off_t  addr, nblocks;
     char     *block;
     
+    len   = total_vec_len(vec, count);
+    *_len = 0;    /* this will now count up */
+
     if (len == 0)    /* just a quick check */
         return 0;
 
     if (pos < 0)
         pos = 0;
     
-    if (pos > mi->data.size) {
-        *_len = 0;
+    if (pos >= mi->data.size)
         return 0;
-    }
 
-    *_len = 0;    /* this will now count up */
-    
     if (pos + len > mi->data.size)
         len = mi->data.size - pos;
 
-    addr = file_pos_to_disk_addr(myfs, mi, pos);
-    if (addr < 0)
-        return EINVAL;
-
-    if ((pos % bsize) != 0) { /* then we have to work up to a block boundary */
-        block = get_block(myfs->fd, addr, bsize);
-        if (block == NULL)
-            return EINVAL;
+    if (mi->flags & INODE_INLINE) {
+        copy_to_vecs(&vec, &voff, &mi->etc->inline_data[pos], len);
+        *_len = len;
+        return 0;
+    }
 
+    /*
+       this is the main data reading loop.  each block is mapped and
+       fetched once and then scattered across however many of the
+       caller's buffers it covers.  whole blocks that land in a single
+       buffer are read straight into it instead, a run of contiguous
+       blocks at a time, so a big read is one big i/o.
+    */
+    while(*_len < len) {
         offset = (pos % bsize);
-        if (len < (bsize - offset))
-            amt = len;
+        if ((len - *_len) < (bsize - offset))
+            amt = len - *_len;
         else
             amt = (bsize - offset);
 
-        memcpy(buf, &block[offset], amt);
+        if (mi->etc->da_buf && pos >= mi->etc->da_start) {
+            copy_to_vecs(&vec, &voff,
+                         &mi->etc->da_buf[pos - mi->etc->da_start], amt);
+            pos   += amt;
+            *_len += amt;
+            continue;
+        }
+
+        addr = file_pos_to_entry(myfs, mi, pos);
+        if (addr < 0)
+            return EINVAL;
+
+        if (addr & UNWRITTEN_BLOCK) {     /* nothing on disk to read */
+            copy_to_vecs(&vec, &voff, NULL, amt);
+            pos   += amt;
+            *_len += amt;
+            continue;
+        }
+
+        nblocks = vec->iov_len - voff;
+        if (nblocks > len - *_len)
+            nblocks = len - *_len;
+        nblocks /= bsize;
+
+        if (offset == 0 && nblocks > 0) {
+            nblocks = contig_blocks(myfs, mi, pos, addr, nblocks);
+            if (cached_read(myfs->fd, addr, (char *)vec->iov_base + voff,
+                            nblocks, bsize) != 0)
+                return EINVAL;
+
+            skip_vecs(&vec, &voff, nblocks * bsize);
+            pos   += nblocks * bsize;
+            *_len += nblocks * bsize;
+            myfs->read_runs++;
+            myfs->read_run_blocks += nblocks;
+            continue;
+        }
+
+        block = get_block(myfs->fd, addr, bsize);
+        if (block == NULL)
+            return EINVAL;
+
+        copy_to_vecs(&vec, &voff, &block[offset], amt);
 
-        buf   += amt;
         pos   += amt;
         *_len += amt;
 
         release_block(myfs->fd, addr);
     }
 
-    /* this is the main data reading loop */
-    for(; *_len < len; *_len+=amt) {
+    return 0;
+}
+
+
+/*
+  where the next block of a file should go: right after its current
+  last block, or at its inode's home if it doesn't have any blocks yet.
+*/
+static fs_off_t
+next_block_goal(myfs_info *myfs, myfs_inode *mi)
+{
+    int bsize = myfs->dsb.block_size;
+
+    if (mi->data.size < bsize)
+        return myfs_home_block(myfs, mi->inode_num);
+
+    return file_pos_to_disk_addr(myfs, mi, (mi->data.size - 1) & ~(bsize - 1)) + 1;
+}
+
+
+/*
+  count the runs of contiguous blocks that make up a file.  a file
+  laid out in one piece has one; more than that means it's fragmented.
+*/
+int
+myfs_count_extents(myfs_info *myfs, myfs_inode *mi, int *count)
+{
+    int       bsize = myfs->dsb.block_size;
+    fs_off_t  pos, addr, prev = -2, end = mi->data.size;
+
+    if (mi->etc->da_buf && end > mi->etc->da_start)
+        end = mi->etc->da_start;       /* delayed data has no blocks yet */
+
+    *count = 0;
+    if (mi->flags & INODE_INLINE)      /* no blocks at all */
+        return 0;
+
+    for(pos=0; pos < end; pos += bsize) {
         addr = file_pos_to_disk_addr(myfs, mi, pos);
         if (addr < 0)
             return EINVAL;
 
-        block = get_block(myfs->fd, addr, bsize);
-        if (block == NULL)
-            return EINVAL;
+        if (addr != prev + 1)
+            *count += 1;
+        prev = addr;
+    }
 
-        if ((len - *_len) < bsize)
-            amt = len - *_len;
-        else
-            amt = bsize;
+    return 0;
+}
 
-        memcpy(buf, block, amt);
 
-        buf   += amt;
-        pos   += amt;
+/*
+  grow_dstream() gets its blocks a run at a time, as many as it still
+  needs in one go.  a block_run holds what's left of the current run.
+*/
+typedef struct block_run {
+    myfs_inode *mi;       /* the file the blocks are for */
+    fs_off_t  addr;       /* the next unused block in the run */
+    fs_off_t  len;        /* how many unused blocks are left */
+    fs_off_t  goal;       /* where we'd like the next run to start */
+} block_run;
 
-        release_block(myfs->fd, addr);
+
+static int
+next_run_block(myfs_info *myfs, block_run *br, fs_off_t wanted,
+               fs_off_t *addr)
+{
+    fs_off_t  nblocks;
+    int       err;
+
+    if (br->len == 0) {
+        nblocks = wanted;
+        err = myfs_allocate_blocks(myfs, br->mi, br->goal, &nblocks,
+                                   &br->addr, LOOSE_ALLOCATION);
+        if (err != 0)
+            return err;
+
+        if (br->addr < 0)
+            return ENOSPC;
+
+        br->len = nblocks;
     }
 
+    *addr = br->addr++;
+    br->len--;
+    br->goal = br->addr;
+
     return 0;
 }
 
 
+/*
+  grow_dstream() for a file mapped by extents.  each run the allocator
+  hands back is one extent (or makes the last one longer), so there's
+  nothing to do per block.
+*/
+static int
+grow_extents(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size,
+             fs_off_t flags)
+{
+    int          bsize = myfs->dsb.block_size, err = 0;
+    uint32       eflags = (flags & UNWRITTEN_BLOCK) ? EXTENT_UNWRITTEN : 0;
+    fs_off_t     lblock, end, nblocks, addr, goal;
+    file_extent  e;
+
+    lblock = (mi->data.size + bsize - 1) / bsize;
+    end    = (new_size + bsize - 1) / bsize;
+
+    if (end > EXTENT_MAX_BLOCKS)
+        return E2BIG;
+
+    if (lblock == end) {                    /* can grow in-place */
+        mi->data.size = new_size;
+        return 0;
+    }
+
+    mi->data.size = lblock * bsize;
+    goal = next_block_goal(myfs, mi);
+
+    while(lblock < end) {
+        /* blocks preallocated past the end of the file are used as is */
+        if (extent_lookup(myfs, &mi->data, lblock, &e)) {
+            nblocks = e.lblock + EXT_LEN(&e) - lblock;
+            if (nblocks > end - lblock)
+                nblocks = end - lblock;
+        } else {
+            nblocks = end - lblock;
+            err = myfs_allocate_blocks(myfs, mi, goal, &nblocks, &addr,
+                                       LOOSE_ALLOCATION);
+            if (err == 0 && addr < 0)
+                err = ENOSPC;
+            if (err != 0)
+                break;
+
+            err = extent_append(myfs, &mi->data, lblock, addr, nblocks,
+                                eflags);
+            if (err != 0) {
+                myfs_free_blocks(myfs, addr, nblocks);
+                break;
+            }
+
+            goal = addr + nblocks;
+        }
+
+        lblock       += nblocks;
+        mi->data.size = lblock * bsize;
+    }
+
+    if (err == 0)
+        mi->data.size = new_size;
+
+    return err;
+}
+
+
+/*
+  grow a file to new_size.  flags gets or'ed into the pointers of the
+  new blocks (UNWRITTEN_BLOCK for preallocation).  blocks that were
+  preallocated past the end of the file are used as they are.
+*/
 static int
-grow_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
+grow_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size,
+             fs_off_t flags)
 {
     int       bsize = myfs->dsb.block_size;
-    int       index, err;
-    fs_off_t  i, max_index = bsize / sizeof(fs_off_t);
-    fs_off_t  addr, offset;
-    fs_off_t  cur_size_rounded, new_size_rounded, num_blocks_needed;
-    fs_off_t  nblocks;
-    fs_off_t *block, *block2;
+    int       index, err = 0;
+    fs_off_t  max_index = bsize / sizeof(fs_off_t);
+    fs_off_t  addr, limit, blocks_left;
+    fs_off_t  cur_size_rounded, new_size_rounded;
+    fs_off_t *block;
+    block_run br;
     
+    map_cache_invalidate(mi);
+
+    if (EXTENT_MAPPED(myfs))
+        return grow_extents(myfs, mi, new_size, flags);
+
     if (new_size > MAX_DOUBLE_INDIRECT_RANGE)
         return E2BIG;
 
@@ -193,39 +685,44 @@ grow_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
         return 0;
     }
 
-    num_blocks_needed = ((new_size_rounded - cur_size_rounded) / bsize);
+    /*
+       count all the blocks we're going to need (including an indirect
+       block if we'll have to start one) so they can be asked for at once.
+    */
+    limit = new_size_rounded;
+    if (limit > MAX_INDIRECT_RANGE)
+        limit = MAX_INDIRECT_RANGE;
+
+    blocks_left = (limit - cur_size_rounded) / bsize;
+    if (mi->data.indirect == 0 && limit > MAX_DIRECT_RANGE)
+        blocks_left++;
 
-    i = 0;
     mi->data.size = cur_size_rounded;
 
+    br.mi   = mi;
+    br.len  = 0;
+    br.goal = next_block_goal(myfs, mi);
+
     if (cur_size_rounded < DIRECT_SIZE) {   /* grow the direct blocks first */
 
         /* use the rounded size to calculate the index to start growing at */
         index = cur_size_rounded / bsize;
 
-        if (mi->data.direct[index] != 0) {
-            myfs_die("grow_dstream: mi (inum %ld): direct[%d] == %ld, not "
-                     "zero!\n", mi->inode_num, index, mi->data.direct[index]);
-        }
+        for(; mi->data.size < new_size && index < NUM_DIRECT_BLOCKS; index++){
+            if (mi->data.direct[index] == 0) {
+                err = next_run_block(myfs, &br, blocks_left, &addr);
+                if (err != 0)
+                    goto out;
 
-        for(; i < num_blocks_needed && index < NUM_DIRECT_BLOCKS; i++,index++){
-            nblocks = 1;
-            err = myfs_allocate_blocks(myfs, mi->inode_num, &nblocks, &addr,
-                                       EXACT_ALLOCATION);
-            if (err != 0)
-                return err;
-            
-            if (addr < 0)
-                return ENOSPC;
+                mi->data.direct[index] = addr | flags;
+            }
 
-            mi->data.direct[index]  = addr;
-            mi->data.size          += bsize;
+            blocks_left--;
+            mi->data.size += bsize;
         }
 
-        if (mi->data.size >= new_size) {   /* all done! */
-            mi->data.size = new_size;
-            return 0;
-        }
+        if (mi->data.size >= new_size)    /* all done! */
+            goto out;
     }
 
     /* now see if we have to grow the indirect range */
@@ -233,53 +730,57 @@ grow_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
         mi->data.size < MAX_INDIRECT_RANGE) {
         
         if (mi->data.indirect == 0) {
-            nblocks = 1;
-            err = myfs_allocate_blocks(myfs, mi->inode_num, &nblocks, &addr,
-                                       EXACT_ALLOCATION);
+            err = next_run_block(myfs, &br, blocks_left, &addr);
             if (err != 0)
-                return err;
-            
-            if (addr < 0)
-                return ENOSPC;
+                goto out;
 
+            blocks_left--;
             mi->data.indirect = addr;
             block = get_empty_block(myfs->fd, addr, bsize);
+            memset(block, 0, bsize);
         } else {
             block = get_block(myfs->fd, mi->data.indirect, bsize);
         }
 
         index = (mi->data.size - MAX_DIRECT_RANGE) / bsize;
-        for(; i < num_blocks_needed && index < max_index; i++, index++) {
-            nblocks = 1;
-            err = myfs_allocate_blocks(myfs, mi->inode_num, &nblocks, &addr,
-                                       EXACT_ALLOCATION);
-            if (err != 0)
-                return err;
-            
-            if (addr < 0)
-                return ENOSPC;
-            
-            block[index]   = addr;
+        for(; mi->data.size < new_size && index < max_index; index++) {
+            if (block[index] == 0) {
+                err = next_run_block(myfs, &br, blocks_left, &addr);
+                if (err != 0)
+                    break;
+
+                block[index] = addr | flags;
+            }
+
+            blocks_left--;
             mi->data.size += bsize;
         }
 
         mark_blocks_dirty(myfs->fd, mi->data.indirect, 1);
         release_block(myfs->fd, mi->data.indirect);
 
-        if (mi->data.size >= new_size) {   /* all done! */
-            mi->data.size = new_size;
-
-            return 0;
-        }
+        if (err != 0 || mi->data.size >= new_size)
+            goto out;
     }
     
     if (mi->data.size >= MAX_INDIRECT_RANGE) {
         /* XXXdbg -- growing double indirect blocks! */
         printf("grow the double indirect blocks....\n");
-        return E2BIG;
+        err = E2BIG;
+        goto out;
     }
 
-    return -1;
+    err = -1;
+
+ out:
+    if (err == 0)
+        mi->data.size = new_size;
+
+    /* give back whatever is left of the last run */
+    if (br.len > 0)
+        myfs_free_blocks(myfs, br.addr, br.len);
+
+    return err;
 }
 
 
@@ -344,6 +845,54 @@ shrink_double_indirect(myfs_info *myfs, myfs_inode *mi,
 }
 
 
+/*
+  blocks being freed are collected into runs so that a file laid out in
+  one piece goes back to the bitmap with one call instead of one per
+  block.
+*/
+typedef struct free_run {
+    fs_off_t  start;
+    fs_off_t  len;
+} free_run;
+
+
+static void
+flush_free_run(myfs_info *myfs, free_run *fr)
+{
+    if (fr->len == 0)
+        return;
+
+    if (myfs_free_blocks(myfs, fr->start, fr->len) != 0)
+        printf("error freeing block run %ld:%ld\n", (long)fr->start,
+               (long)fr->len);
+
+    fr->len = 0;
+}
+
+
+static void
+free_run_block(myfs_info *myfs, free_run *fr, fs_off_t addr)
+{
+    addr = BLOCK_ADDR(addr);
+
+    if (fr->len > 0 && addr == fr->start + fr->len) {
+        fr->len++;
+        return;
+    }
+
+    /* shrink_dstream() gets to the indirect block after its data */
+    if (fr->len > 0 && addr == fr->start - 1) {
+        fr->start--;
+        fr->len++;
+        return;
+    }
+
+    flush_free_run(myfs, fr);
+    fr->start = addr;
+    fr->len   = 1;
+}
+
+
 static int
 shrink_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
 {
@@ -352,22 +901,36 @@ shrink_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
     fs_off_t  addr, offset;
     fs_off_t  cur_size_rounded, new_size_rounded;
     fs_off_t *block, *block2;
+    free_run  fr;
     
-    if (new_size > MAX_DOUBLE_INDIRECT_RANGE)
+    if (EXTENT_MAPPED(myfs) == 0 && new_size > MAX_DOUBLE_INDIRECT_RANGE)
         return E2BIG;
 
+    map_cache_invalidate(mi);
+
     /* round up the current file size to the next block boundary */
     cur_size_rounded = (mi->data.size + bsize - 1) & ~(bsize - 1);
 
     /* round up the new file size to the next block boundary */
-    new_size_rounded = (new_size - 1 + bsize - 1) & ~(bsize - 1);
+    new_size_rounded = (new_size + bsize - 1) & ~(bsize - 1);
+
+    /* preallocated blocks past the end still have to go */
+    if (cur_size_rounded == new_size_rounded &&
+        block_mapped(myfs, mi, cur_size_rounded) == 0) {  /* in-place */
+        mi->data.size = new_size;
+        return 0;
+    }
 
-    if (cur_size_rounded == new_size_rounded) {  /* can shrink in-place */
+    /* whole extents at a time */
+    if (EXTENT_MAPPED(myfs)) {
+        extent_truncate(myfs, &mi->data, new_size_rounded / bsize);
         mi->data.size = new_size;
         return 0;
     }
 
 
+    fr.len = 0;
+
     /*
        start trimming the fat at the double indirect blocks and work
        backwards from there.
@@ -392,18 +955,15 @@ shrink_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
             if (block[i] == 0)
                 break;
 
-            if (myfs_free_blocks(myfs, block[i], 1) != 0)
-                printf("1: error freeing indirect block %ld for inode %ld\n",
-                       block[i], mi->inode_num);
+            free_run_block(myfs, &fr, block[i]);
+            block[i] = 0;
         }
 
+        mark_blocks_dirty(myfs->fd, mi->data.indirect, 1);
         release_block(myfs->fd, mi->data.indirect);
 
         if (free_block) {
-            if (myfs_free_blocks(myfs, mi->data.indirect, 1) != 0)
-                printf("1: error freeing indirect block %ld for inode %ld\n",
-                       mi->data.indirect, mi->inode_num);
-
+            free_run_block(myfs, &fr, mi->data.indirect);
             mi->data.indirect = 0;
         }
     }
@@ -416,14 +976,13 @@ shrink_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
             if (mi->data.direct[i] == 0)
                 break;
             
-            if (myfs_free_blocks(myfs, mi->data.direct[i], 1) != 0)
-                printf("error free'ing direct data block %ld\n",
-                       mi->data.direct[i]);
-
+            free_run_block(myfs, &fr, mi->data.direct[i]);
             mi->data.direct[i] = 0;
         }
     }
 
+    flush_free_run(myfs, &fr);
+
     mi->data.size = new_size;
 
     return 0;
@@ -431,87 +990,482 @@ shrink_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
 
 
 
+/*
+  delayed allocation.  with MYFS_FEATURE_DELALLOC a regular file that
+  grows keeps the new data in memory and only reserves blocks for it.
+  the blocks get allocated when the data is written back (on sync or
+  fsync, when the vnode goes away, or when the data has been sitting
+  around too long) and by then the whole run is known so it can go in
+  one piece.  a file that is removed before then never touches the
+  bitmap at all.
+
+  everything from etc->da_start (a block boundary) to the end of the
+  file lives in etc->da_buf.  the inode on disk only goes as far as
+  da_start so it never points at blocks that don't exist yet.
+*/
+#define DELALLOC_MAX_BLOCKS    256        /* most a single file buffers */
+#define DELALLOC_MAX_RESERVED  4096       /* most a volume buffers */
+#define DELALLOC_MAX_AGE       5000000    /* usecs before it's written back */
+
+
+/*
+  the blocks that data from start to end needs, indirect block included.
+  an extent mapped file might need a tree block per level and a new root.
+*/
+static fs_off_t
+delalloc_blocks(myfs_info *myfs, myfs_inode *mi, fs_off_t start, fs_off_t end)
+{
+    int       bsize = myfs->dsb.block_size;
+    fs_off_t  nblocks;
+
+    end = (end + bsize - 1) & ~(bsize - 1);
+    if (end <= start)
+        return 0;
+
+    nblocks = (end - start) / bsize;
+    if (EXTENT_MAPPED(myfs))
+        nblocks += extent_depth(&mi->data) + 1;
+    else if (mi->data.indirect == 0 && end > MAX_DIRECT_RANGE)
+        nblocks++;
+
+    return nblocks;
+}
+
+
+static int
+delalloc_wanted(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
+{
+    int       bsize = myfs->dsb.block_size;
+    fs_off_t  start, end;
+
+    if ((myfs->dsb.features & MYFS_FEATURE_DELALLOC) == 0 ||
+        MY_S_ISREG(mi->mode) == 0)
+        return 0;
+
+    if (mi->etc->da_buf)
+        start = mi->etc->da_start;
+    else
+        start = (mi->data.size + bsize - 1) & ~(bsize - 1);
+    end = (new_size + bsize - 1) & ~(bsize - 1);
+
+    /* preallocated blocks are there to be written into */
+    if (block_mapped(myfs, mi, start))
+        return 0;
+
+    /* XXXdbg -- grow_dstream() can't do double indirect blocks yet */
+    if (EXTENT_MAPPED(myfs) == 0 && end > MAX_INDIRECT_RANGE)
+        return 0;
+
+    return ((end - start) / bsize <= DELALLOC_MAX_BLOCKS);
+}
+
+
+/* make the inode's reservation nblocks, if there are enough free blocks */
+static int
+delalloc_reserve(myfs_info *myfs, myfs_inode *mi, fs_off_t nblocks)
+{
+    fs_off_t more = nblocks - mi->etc->da_reserved;
+
+    acquire_sem(myfs->bbm_sem);
+
+    if (more > 0 && more > NUM_AVAIL_BLOCKS(myfs)) {
+        release_sem(myfs->bbm_sem);
+        return ENOSPC;
+    }
+
+    myfs->bbm.reserved  += more;
+    mi->etc->da_reserved = nblocks;
+
+    release_sem(myfs->bbm_sem);
+
+    return 0;
+}
+
+
+static void
+delalloc_unlink(myfs_info *myfs, myfs_inode *mi)
+{
+    myfs_inode **ptr, *prev = NULL;
+
+    for(ptr=&myfs->da_head; *ptr; prev=*ptr, ptr=&(*ptr)->etc->da_next) {
+        if (*ptr == mi) {
+            *ptr = mi->etc->da_next;
+            if (myfs->da_tail == mi)
+                myfs->da_tail = prev;
+            break;
+        }
+    }
+
+    mi->etc->da_next = NULL;
+}
+
+
+static int
+delalloc_grow(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
+{
+    int             bsize = myfs->dsb.block_size, err;
+    myfs_inode_etc *etc = mi->etc;
+    fs_off_t        start, old_len, new_len;
+    char           *buf;
+
+    start = (mi->data.size + bsize - 1) & ~(bsize - 1);
+    if (etc->da_buf)
+        start = etc->da_start;
+
+    old_len = ((mi->data.size + bsize - 1) & ~(bsize - 1)) - start;
+    new_len = ((new_size + bsize - 1) & ~(bsize - 1)) - start;
+
+    if (new_len <= old_len) {     /* it still fits in the last block */
+        mi->data.size = new_size;
+        return 0;
+    }
+
+    err = delalloc_reserve(myfs, mi, delalloc_blocks(myfs, mi, start,
+                                                     new_size));
+    if (err != 0)
+        return err;
+
+    buf = (char *)realloc(etc->da_buf, new_len);
+    if (buf == NULL) {
+        delalloc_reserve(myfs, mi, delalloc_blocks(myfs, mi, start,
+                                                   mi->data.size));
+        return ENOMEM;
+    }
+
+    memset(&buf[old_len], 0, new_len - old_len);
+
+    if (etc->da_buf == NULL) {    /* put it at the end of the line */
+        etc->da_start = start;
+        etc->da_time  = system_time();
+
+        if (myfs->da_tail)
+            myfs->da_tail->etc->da_next = mi;
+        else
+            myfs->da_head = mi;
+        myfs->da_tail = mi;
+    }
+
+    etc->da_buf   = buf;
+    mi->data.size = new_size;
+
+    return 0;
+}
+
+
+/* forget delayed data without ever giving it blocks */
+static void
+delalloc_drop(myfs_info *myfs, myfs_inode *mi)
+{
+    myfs_inode_etc *etc = mi->etc;
+
+    if (etc->da_buf == NULL)
+        return;
+
+    myfs->da_dropped += etc->da_reserved;
+
+    delalloc_unlink(myfs, mi);
+    delalloc_reserve(myfs, mi, 0);
+
+    free(etc->da_buf);
+    etc->da_buf = NULL;
+
+    if (mi->data.size > etc->da_start)
+        mi->data.size = etc->da_start;
+}
+
+
+/*
+  give an inode's delayed data its blocks and put the data in the
+  cache.  the blocks are all asked for at once so they come back as
+  one run if there is one.
+*/
+int
+myfs_flush_delalloc(myfs_info *myfs, myfs_inode *mi)
+{
+    int             bsize = myfs->dsb.block_size, err;
+    myfs_inode_etc *etc = mi->etc;
+    fs_off_t        size = mi->data.size, pos, addr, nblocks = 0;
+    char           *block;
+
+    if (etc->da_buf == NULL)
+        return 0;
+
+    delalloc_unlink(myfs, mi);
+    delalloc_reserve(myfs, mi, 0);
+
+    mi->data.size = etc->da_start;
+    err = grow_dstream(myfs, mi, size, 0);
+    if (err != 0)
+        printf("delalloc: inode %ld: could only write %ld of %ld bytes (%s)\n",
+               mi->inode_num, mi->data.size, size, strerror(err));
+
+    /* whole blocks are being written so there's no need to read them */
+    for(pos=etc->da_start; pos < mi->data.size; pos += bsize, nblocks++) {
+        addr = file_pos_to_disk_addr(myfs, mi, pos);
+        if (addr < 0) {
+            err = EINVAL;
+            break;
+        }
+
+        block = get_empty_block(myfs->fd, addr, bsize);
+        if (block == NULL) {
+            err = EINVAL;
+            break;
+        }
+
+        memcpy(block, &etc->da_buf[pos - etc->da_start], bsize);
+
+        mark_blocks_dirty(myfs->fd, addr, 1);
+        release_block(myfs->fd, addr);
+    }
+
+    myfs->da_flushes++;
+    myfs->da_flushed += nblocks;
+
+    free(etc->da_buf);
+    etc->da_buf = NULL;
+
+    update_inode(myfs, mi);
+
+    return err;
+}
+
+
+/* write back all the delayed data on a volume */
+int
+myfs_sync_delalloc(myfs_info *myfs)
+{
+    int err = 0;
+
+    while(myfs->da_head) {
+        if (myfs_flush_delalloc(myfs, myfs->da_head) != 0)
+            err = EIO;
+    }
+
+    return err;
+}
+
+
+/*
+  there's no flusher thread to age out delayed data so writers check
+  the oldest inode themselves.  too much buffered data gets pushed out
+  the same way.
+*/
+static void
+delalloc_flush_old(myfs_info *myfs)
+{
+    bigtime_t now = system_time();
+
+    while(myfs->da_head &&
+          (myfs->bbm.reserved > DELALLOC_MAX_RESERVED ||
+           now - myfs->da_head->etc->da_time > DELALLOC_MAX_AGE)) {
+        myfs_flush_delalloc(myfs, myfs->da_head);
+    }
+}
+
+
+/* grow a file, delaying the allocation if we can */
+static int
+extend_dstream(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
+{
+    int err;
+
+    if (delalloc_wanted(myfs, mi, new_size))
+        return delalloc_grow(myfs, mi, new_size);
+
+    err = myfs_flush_delalloc(myfs, mi);
+    if (err == 0)
+        err = grow_dstream(myfs, mi, new_size, 0);
+
+    return err;
+}
+
+
+/*
+  inline data.  on a volume made with "-o inline" a new inode starts out
+  with INODE_INLINE set and keeps its data in the room after it in the
+  inode table (mi->etc->inline_data) instead of in blocks.  anything in
+  that room past the end of the file is kept zeroed.  once the file
+  outgrows it the data is moved out to blocks and the flag goes away
+  for good.
+*/
+static int
+uninline_dstream(myfs_info *myfs, myfs_inode *mi)
+{
+    int      err;
+    size_t   len = mi->data.size, sz = len;
+    char    *buf;
+
+    buf = (char *)malloc(len + 1);
+    if (buf == NULL)
+        return ENOMEM;
+
+    memcpy(buf, mi->etc->inline_data, len);
+    memset(mi->etc->inline_data, 0, INLINE_SIZE(myfs));
+    mi->flags    &= ~INODE_INLINE;
+    mi->data.size = 0;
+
+    err = myfs_write_data_stream(myfs, mi, 0, buf, &sz);
+    if (err == 0 && sz != len)
+        err = ENOSPC;
+
+    if (err != 0) {          /* put it back the way it was */
+        delalloc_drop(myfs, mi);
+        shrink_dstream(myfs, mi, 0);
+        memcpy(mi->etc->inline_data, buf, len);
+        mi->flags    |= INODE_INLINE;
+        mi->data.size = len;
+    } else {
+        myfs->inline_moved++;
+    }
+
+    free(buf);
+
+    return err;
+}
+
+
 int
 myfs_write_data_stream(myfs_info *myfs, myfs_inode *mi,
                            fs_off_t pos, const char *buf, size_t *_len)
 {
-    int       i, offset, bsize = myfs->dsb.block_size, err;
-    size_t    len = *_len, amt;
-    fs_off_t  addr;
+    struct iovec iov;
+
+    iov.iov_base = (char *)buf;
+    iov.iov_len  = *_len;
+
+    return myfs_write_data_stream_vecs(myfs, mi, pos, &iov, 1, _len);
+}
+
+int
+myfs_write_data_stream_vecs(myfs_info *myfs, myfs_inode *mi, fs_off_t pos,
+                            const struct iovec *vec, size_t count,
+                            size_t *_len)
+{
+    int       offset, bsize = myfs->dsb.block_size, err;
+    size_t    len, amt, voff = 0;
+    fs_off_t  addr, nblocks;
     char     *block;
     
+    len   = total_vec_len(vec, count);
+    *_len = 0;    /* this will now count up */
+
     if (len == 0)    /* just a quick check */
         return 0;
 
     if (pos < 0)
         pos = 0;
     
+    if (mi->flags & INODE_INLINE) {
+        if (pos + len <= INLINE_SIZE(myfs)) {
+            copy_from_vecs(&vec, &voff, &mi->etc->inline_data[pos], len);
+            if (pos + len > mi->data.size)
+                mi->data.size = pos + len;
+            *_len = len;
+
+            mi->last_modified_time = time(NULL);
+            mark_inode_dirty(myfs, mi);
+            return 0;
+        }
+
+        if ((err = uninline_dstream(myfs, mi)) != 0)
+            return err;
+    }
+
+    if (myfs->da_head)
+        delalloc_flush_old(myfs);
+
     if (pos + len > mi->data.size) {
-        err = grow_dstream(myfs, mi, pos + len);
+        err = extend_dstream(myfs, mi, pos + len);
         if (err) {
             printf("grow dstream failed!\n");
             return err;
         }
 
-        mi->last_modified_time = time(NULL);
-        update_inode(myfs, mi);
-        write_super_block(myfs);
+        mark_inode_dirty(myfs, mi);
     }
 
-    *_len = 0;    /* this will now count up */
-    
-
-    addr = file_pos_to_disk_addr(myfs, mi, pos);
-    if (addr < 0)
-        return EINVAL;
-
-    if ((pos % bsize) != 0) { /* then we have to work up to a block boundary */
-        block = get_block(myfs->fd, addr, bsize);
-        if (block == NULL)
-            return EINVAL;
-
+    /*
+       this is the main data writing loop.  partial blocks at either
+       end get read in first; each block gathers from as many of the
+       caller's buffers as it needs.  whole blocks coming from a single
+       buffer are written straight from it, a run of contiguous blocks
+       at a time, and a whole block that isn't is never read in.
+    */
+    while(*_len < len) {
         offset = (pos % bsize);
-        if (len < (bsize - offset))
-            amt = len;
+        if ((len - *_len) < (bsize - offset))
+            amt = len - *_len;
         else
             amt = (bsize - offset);
 
-        memcpy(&block[offset], buf, amt);
-
-        buf   += amt;
-        pos   += amt;
-        *_len += amt;
-
-        mark_blocks_dirty(myfs->fd, addr, 1);
-        release_block(myfs->fd, addr);
-    }
+        if (mi->etc->da_buf && pos >= mi->etc->da_start) {
+            copy_from_vecs(&vec, &voff,
+                           &mi->etc->da_buf[pos - mi->etc->da_start], amt);
+            pos   += amt;
+            *_len += amt;
+            continue;
+        }
 
-    /* this is the main data writing loop */
-    for(; *_len < len; *_len+=amt) {
-        addr = file_pos_to_disk_addr(myfs, mi, pos);
+        addr = file_pos_to_entry(myfs, mi, pos);
         if (addr < 0)
             return EINVAL;
 
-        block = get_block(myfs->fd, addr, bsize);
-        if (block == NULL)
-            return EINVAL;
+        nblocks = vec->iov_len - voff;
+        if (nblocks > len - *_len)
+            nblocks = len - *_len;
+        nblocks /= bsize;
+
+        if (offset == 0 && nblocks > 0 && (addr & UNWRITTEN_BLOCK) == 0) {
+            nblocks = contig_blocks(myfs, mi, pos, addr, nblocks);
+            if (cached_write(myfs->fd, addr, (char *)vec->iov_base + voff,
+                             nblocks, bsize) != 0)
+                return EINVAL;
+
+            skip_vecs(&vec, &voff, nblocks * bsize);
+            pos   += nblocks * bsize;
+            *_len += nblocks * bsize;
+            myfs->write_runs++;
+            myfs->write_run_blocks += nblocks;
+            continue;
+        }
 
-        if ((len - *_len) < bsize)
-            amt = len - *_len;
-        else
-            amt = bsize;
+        /*
+           a preallocated block has never been written so there is
+           nothing worth reading: start it out as zeros instead.
+        */
+        if (addr & UNWRITTEN_BLOCK) {
+            if ((err = mark_block_written(myfs, mi, pos)) != 0)
+                return err;
+
+            addr  = BLOCK_ADDR(addr);
+            block = get_empty_block(myfs->fd, addr, bsize);
+            if (block == NULL)
+                return EINVAL;
 
-        memcpy(block, buf, amt);
+            memset(block, 0, bsize);
+        } else if (amt == bsize) {
+            block = get_empty_block(myfs->fd, addr, bsize);
+            if (block == NULL)
+                return EINVAL;
+        } else {
+            block = get_block(myfs->fd, addr, bsize);
+            if (block == NULL)
+                return EINVAL;
+        }
+
+        copy_from_vecs(&vec, &voff, &block[offset], amt);
 
-        buf   += amt;
         pos   += amt;
+        *_len += amt;
 
         mark_blocks_dirty(myfs->fd, addr, 1);
         release_block(myfs->fd, addr);
     }
 
+    /* the inode goes back to disk at the last close or the next sync */
     mi->last_modified_time = time(NULL);
-    update_inode(myfs, mi);
+    mark_inode_dirty(myfs, mi);
 
     return 0;
 }
@@ -519,31 +1473,413 @@ myfs_write_data_stream(myfs_info *myfs, myfs_inode *mi,
 int
 myfs_set_file_size(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size)
 {
-    int err = 0;
+    int err = 0, bsize = myfs->dsb.block_size;
     
     if (new_size == mi->data.size)
         return 0;
 
+    if (mi->flags & INODE_INLINE) {
+        if (new_size <= INLINE_SIZE(myfs)) {
+            if (new_size < mi->data.size)
+                memset(&mi->etc->inline_data[new_size], 0,
+                       mi->data.size - new_size);
+            mi->data.size = new_size;
+
+            mi->last_modified_time = time(NULL);
+            update_inode(myfs, mi);
+            return 0;
+        }
+
+        if ((err = uninline_dstream(myfs, mi)) != 0)
+            return err;
+    }
+
+    /* delayed data past the new end just goes away */
+    if (mi->etc->da_buf && new_size < mi->data.size) {
+        if (new_size <= mi->etc->da_start) {
+            delalloc_drop(myfs, mi);
+        } else {
+            fs_off_t n = ((mi->data.size + bsize - 1) & ~(bsize - 1)) - new_size;
+
+            memset(&mi->etc->da_buf[new_size - mi->etc->da_start], 0, n);
+            mi->data.size = new_size;
+            delalloc_reserve(myfs, mi, delalloc_blocks(myfs, mi,
+                                                       mi->etc->da_start,
+                                                       new_size));
+        }
+    }
+
     if (new_size < mi->data.size)
         err = shrink_dstream(myfs, mi, new_size);
-    else
-        err = grow_dstream(myfs, mi, new_size);
+    else if (new_size > mi->data.size)
+        err = extend_dstream(myfs, mi, new_size);
             
     if (err == 0) {
         mi->last_modified_time = time(NULL);
         update_inode(myfs, mi);
-
-        write_super_block(myfs);
     }
         
     return err;
 }
 
+/*
+  the part of the last block past the end of the file was never
+  written and can hold anything.  zero it before the file grows over it.
+*/
+static int
+zero_tail(myfs_info *myfs, myfs_inode *mi)
+{
+    int       bsize = myfs->dsb.block_size, offset;
+    fs_off_t  addr;
+    char     *block;
+
+    offset = mi->data.size % bsize;
+    if (offset == 0)
+        return 0;
+
+    addr = file_pos_to_entry(myfs, mi, mi->data.size);
+    if (addr < 0)
+        return EINVAL;
+
+    if (addr & UNWRITTEN_BLOCK)
+        return 0;
+
+    block = get_block(myfs->fd, addr, bsize);
+    if (block == NULL)
+        return EINVAL;
+
+    memset(&block[offset], 0, bsize - offset);
+
+    mark_blocks_dirty(myfs->fd, addr, 1);
+    release_block(myfs->fd, addr);
+
+    return 0;
+}
+
+
+/*
+  preallocation.  pos..pos+len of a file gets its blocks now, as one run
+  if there is one, so writing it later doesn't go through the allocator
+  at all.  files don't have holes so the range really starts at the
+  current end of the file.  the new blocks are zeroed on disk unless
+  the mode has MY_FALLOC_UNWRITTEN, in which case they're only marked
+  unwritten and read back as zeros until they're written.  with
+  MY_FALLOC_KEEP_SIZE the file size stays put and the blocks sit past
+  the end of the file until it grows into them.
+*/
+int
+myfs_preallocate(myfs_info *myfs, myfs_inode *mi, int mode,
+                 fs_off_t pos, fs_off_t len)
+{
+    int       bsize = myfs->dsb.block_size, err;
+    fs_off_t  size = mi->data.size, end = pos + len, start, addr;
+    char     *block;
+
+    if (pos < 0 || len <= 0)
+        return EINVAL;
+
+    if (MY_S_ISREG(mi->mode) == 0)
+        return EINVAL;
+
+    /* XXXdbg -- grow_dstream() can't do double indirect blocks yet */
+    if (EXTENT_MAPPED(myfs) == 0 && end > MAX_INDIRECT_RANGE)
+        return E2BIG;
+
+    /* the file has no holes so everything before its end has a block */
+    if (end <= size)
+        return 0;
+
+    /* the room for inline data is always there */
+    if (mi->flags & INODE_INLINE) {
+        if (end <= INLINE_SIZE(myfs)) {
+            if ((mode & MY_FALLOC_KEEP_SIZE) == 0) {
+                mi->data.size = end;
+                mi->last_modified_time = time(NULL);
+                update_inode(myfs, mi);
+            }
+            return 0;
+        }
+
+        if ((err = uninline_dstream(myfs, mi)) != 0)
+            return err;
+    }
+
+    err = myfs_flush_delalloc(myfs, mi);
+    if (err == 0 && (mode & MY_FALLOC_KEEP_SIZE) == 0)
+        err = zero_tail(myfs, mi);
+    if (err != 0)
+        return err;
+
+    start = (size + bsize - 1) & ~(bsize - 1);
+
+    err = grow_dstream(myfs, mi, end,
+                       (mode & MY_FALLOC_UNWRITTEN) ? UNWRITTEN_BLOCK : 0);
+    if (err != 0) {
+        mi->data.size = size;   /* what did get allocated is past the eof */
+        goto out;
+    }
+
+    if ((mode & MY_FALLOC_UNWRITTEN) == 0) {
+        for(; start < end; start += bsize) {
+            addr = file_pos_to_entry(myfs, mi, start);
+            if (addr < 0) {
+                err = EINVAL;
+                break;
+            }
+
+            if (addr & UNWRITTEN_BLOCK)   /* reads as zeros already */
+                continue;
+
+            block = get_empty_block(myfs->fd, addr, bsize);
+            if (block == NULL) {
+                err = EINVAL;
+                break;
+            }
+
+            memset(block, 0, bsize);
+
+            mark_blocks_dirty(myfs->fd, addr, 1);
+            release_block(myfs->fd, addr);
+        }
+    }
+
+    if (mode & MY_FALLOC_KEEP_SIZE)
+        mi->data.size = size;
+    else
+        mi->last_modified_time = time(NULL);
+
+ out:
+    update_inode(myfs, mi);
+
+    return err;
+}
+
+/* copy one block of a file being relocated and return its new pointer */
+static fs_off_t
+move_block(myfs_info *myfs, fs_off_t old, fs_off_t addr)
+{
+    int   bsize = myfs->dsb.block_size;
+    char *src, *dst;
+
+    /* an unwritten block has nothing in it worth copying */
+    if ((old & UNWRITTEN_BLOCK) == 0) {
+        src = get_block(myfs->fd, old, bsize);
+        dst = get_empty_block(myfs->fd, addr, bsize);
+        if (src == NULL || dst == NULL)
+            myfs_die("move_block: can't get block %ld or %ld\n", old, addr);
+
+        memcpy(dst, src, bsize);
+
+        mark_blocks_dirty(myfs->fd, addr, 1);
+        release_block(myfs->fd, addr);
+        release_block(myfs->fd, old);
+    }
+
+    return addr | (old & UNWRITTEN_BLOCK);
+}
+
+
+typedef struct relocate_state {
+    data_stream  ds;          /* the new extents */
+    fs_off_t     addr;        /* where the next block goes */
+    int          count;       /* blocks, when just counting */
+} relocate_state;
+
+static int
+count_extent_blocks(myfs_info *myfs, file_extent *e, void *arg)
+{
+    ((relocate_state *)arg)->count += EXT_LEN(e);
+    return 0;
+}
+
+static int
+move_extent(myfs_info *myfs, file_extent *e, void *arg)
+{
+    int             err;
+    relocate_state *rs = (relocate_state *)arg;
+    fs_off_t        i, flag = (e->len & EXTENT_UNWRITTEN) ? UNWRITTEN_BLOCK : 0;
+
+    for(i=0; i < EXT_LEN(e); i++)
+        move_block(myfs, (e->pblock + i) | flag, rs->addr + i);
+
+    err = extent_append(myfs, &rs->ds, e->lblock, rs->addr, EXT_LEN(e),
+                        e->len & EXTENT_UNWRITTEN);
+    if (err == 0)
+        rs->addr += EXT_LEN(e);
+
+    return err;
+}
+
+
+/*
+  myfs_relocate_data_stream() for a file mapped by extents.  the data
+  goes into one run and the new extents (one, unless some are still
+  unwritten) are built in a copy of the data_stream.  any tree blocks
+  that takes come from wherever the allocator likes.
+*/
+static int
+relocate_extents(myfs_info *myfs, myfs_inode *mi)
+{
+    int             err;
+    fs_off_t        nblocks, start;
+    data_stream     old = mi->data;
+    relocate_state  rs;
+
+    rs.count = 0;
+    extent_walk(myfs, &old, count_extent_blocks, &rs);
+
+    nblocks = rs.count;
+    if (nblocks == 0)
+        return 0;
+
+    err = myfs_allocate_blocks(myfs, NULL,
+                               myfs_home_block(myfs, mi->inode_num),
+                               &nblocks, &start, EXACT_ALLOCATION);
+    if (err != 0)
+        return err;
+
+    memset(&rs.ds, 0, sizeof(rs.ds));
+    rs.ds.size = old.size;
+    rs.addr    = start;
+
+    err = extent_walk(myfs, &old, move_extent, &rs);
+    if (err != 0) {
+        extent_truncate(myfs, &rs.ds, 0);
+        if (rs.addr < start + nblocks)
+            myfs_free_blocks(myfs, rs.addr, start + nblocks - rs.addr);
+        return err;
+    }
+
+    /* the copies have to be on disk before the inode points at them */
+    flush_blocks(myfs->fd, start, nblocks);
+    extent_flush_tree(myfs, &rs.ds);
+
+    mi->data = rs.ds;
+    map_cache_invalidate(mi);
+    update_inode(myfs, mi);
+
+    extent_truncate(myfs, &old, 0);
+
+    return 0;
+}
+
+
+/*
+  rewrite a file into a single run of blocks: its indirect block first
+  and then all of its data blocks in order, so reading it straight
+  through never seeks.  the data is copied through the cache and the new
+  pointers are built on the side.  only once the copies are on disk does
+  the inode get switched over to them (one inode write), so a crash in
+  the middle leaves the file as it was.  the old blocks are freed last.
+*/
+int
+myfs_relocate_data_stream(myfs_info *myfs, myfs_inode *mi)
+{
+    int          bsize = myfs->dsb.block_size, err;
+    fs_off_t     i, max_index = bsize / sizeof(fs_off_t);
+    fs_off_t     nblocks = 0, ndirect = 0, nindirect = 0, start, addr;
+    fs_off_t    *old_block = NULL, *new_block = NULL;
+    data_stream  old = mi->data, ds;
+    free_run     fr;
+
+    if (MY_S_ISREG(mi->mode) == 0)
+        return EINVAL;
+
+    if (mi->flags & INODE_INLINE)      /* nothing to move */
+        return 0;
+
+    /* XXXdbg -- grow_dstream() can't make double indirect blocks anyway */
+    if (EXTENT_MAPPED(myfs) == 0 && mi->data.double_indirect != 0)
+        return E2BIG;
+
+    err = myfs_flush_delalloc(myfs, mi);
+    if (err != 0)
+        return err;
+
+    myfs_release_window(myfs, mi);
+
+    if (EXTENT_MAPPED(myfs))
+        return relocate_extents(myfs, mi);
+
+    /* count every block the file has, preallocated ones included */
+    while(ndirect < NUM_DIRECT_BLOCKS && old.direct[ndirect] != 0)
+        ndirect++;
+
+    if (old.indirect != 0) {
+        old_block = get_block(myfs->fd, old.indirect, bsize);
+        if (old_block == NULL)
+            return EINVAL;
+
+        while(nindirect < max_index && old_block[nindirect] != 0)
+            nindirect++;
+    }
+
+    nblocks = ndirect + nindirect + (old.indirect != 0);
+    if (nblocks == 0)
+        goto out;
+
+    err = myfs_allocate_blocks(myfs, NULL,
+                               myfs_home_block(myfs, mi->inode_num),
+                               &nblocks, &start, EXACT_ALLOCATION);
+    if (err != 0)
+        goto out;
+
+    ds   = old;
+    addr = start;
+
+    if (old.indirect != 0) {
+        ds.indirect = addr++;
+        new_block = get_empty_block(myfs->fd, ds.indirect, bsize);
+        memset(new_block, 0, bsize);
+    }
+
+    for(i=0; i < ndirect; i++)
+        ds.direct[i] = move_block(myfs, old.direct[i], addr++);
+
+    for(i=0; i < nindirect; i++)
+        new_block[i] = move_block(myfs, old_block[i], addr++);
+
+    if (new_block) {
+        mark_blocks_dirty(myfs->fd, ds.indirect, 1);
+        release_block(myfs->fd, ds.indirect);
+    }
+
+    /* the copies have to be on disk before the inode points at them */
+    flush_blocks(myfs->fd, start, nblocks);
+
+    mi->data = ds;
+    map_cache_invalidate(mi);
+    update_inode(myfs, mi);
+
+    fr.len = 0;
+    for(i=0; i < ndirect; i++)
+        free_run_block(myfs, &fr, old.direct[i]);
+    for(i=0; i < nindirect; i++)
+        free_run_block(myfs, &fr, old_block[i]);
+    flush_free_run(myfs, &fr);
+
+ out:
+    if (old_block) {
+        release_block(myfs->fd, old.indirect);
+        if (err == 0)
+            myfs_free_blocks(myfs, old.indirect, 1);
+    }
+
+    return err;
+}
+
 int
 myfs_free_data_stream(myfs_info *myfs, myfs_inode *mi)
 {
+    if (mi->flags & INODE_INLINE) {
+        memset(mi->etc->inline_data, 0, INLINE_SIZE(myfs));
+        mi->data.size = 0;
+        return 0;
+    }
+
+    myfs_release_window(myfs, mi);
+    delalloc_drop(myfs, mi);
     shrink_dstream(myfs, mi, 0);
-    write_super_block(myfs);
     
     return 0;
 }
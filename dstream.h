@@ -4,5 +4,17 @@ int myfs_read_data_stream(myfs_info *myfs, myfs_inode *mi,
                            fs_off_t pos, char *buf, size_t *len);
 int myfs_write_data_stream(myfs_info *myfs, myfs_inode *mi,
                            fs_off_t pos, const char *buf, size_t *len);
+int myfs_read_data_stream_vecs(myfs_info *myfs, myfs_inode *mi, fs_off_t pos,
+                           const struct iovec *vec, size_t count,
+                           size_t *len);
+int myfs_write_data_stream_vecs(myfs_info *myfs, myfs_inode *mi, fs_off_t pos,
+                           const struct iovec *vec, size_t count,
+                           size_t *len);
 int myfs_set_file_size(myfs_info *myfs, myfs_inode *mi, fs_off_t new_size);
 int myfs_free_data_stream(myfs_info *myfs, myfs_inode *mi);
+int myfs_count_extents(myfs_info *myfs, myfs_inode *mi, int *count);
+int myfs_flush_delalloc(myfs_info *myfs, myfs_inode *mi);
+int myfs_sync_delalloc(myfs_info *myfs);
+int myfs_relocate_data_stream(myfs_info *myfs, myfs_inode *mi);
+int myfs_preallocate(myfs_info *myfs, myfs_inode *mi, int mode,
+                     fs_off_t pos, fs_off_t len);
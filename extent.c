@@ -0,0 +1,593 @@
+/*
+  This file contains the extent map that a volume made with "-o extentmap"
+  uses instead of direct and indirect block pointers.
+
+  An extent maps a run of a file's blocks to a run of blocks on disk.
+  The extents are kept in a b+tree ordered by file block.  The root of
+  the tree is the block pointer area of the data_stream in the inode,
+  which holds NUM_ROOT_EXTENTS entries.  When that isn't enough they
+  move out to a tree block and the root indexes it instead (the depth
+  goes up by one).  Index entries are file_extents too: lblock is the
+  lowest file block under the child and pblock is where the child is.
+
+  A file laid out in one piece is one extent however big it is, so
+  mapping any block of it reads no metadata at all.  Files don't have
+  holes so extents get added at the end and truncation trims the end.
+  The one exception is writing into a preallocated (unwritten) extent,
+  which splits it.
+*/
+#include "myfs.h"
+
+
+static extent_node *
+root_node(data_stream *ds)
+{
+    extent_node *root = (extent_node *)ds;
+
+    if (root->hdr.magic == 0) {          /* a file that never had blocks */
+        memset(root, 0, offsetof(data_stream, size));
+        root->hdr.magic = EXTENT_MAGIC;
+        root->hdr.max   = NUM_ROOT_EXTENTS;
+    } else if (root->hdr.magic != EXTENT_MAGIC) {
+        myfs_die("extent: bad extent root @ 0x%lx (magic 0x%x)\n",
+                 (ulong)ds, root->hdr.magic);
+    }
+
+    return root;
+}
+
+
+static extent_node *
+get_node(myfs_info *myfs, fs_off_t bnum)
+{
+    extent_node *node;
+
+    node = (extent_node *)get_block(myfs->fd, bnum, myfs->dsb.block_size);
+    if (node == NULL)
+        myfs_die("extent: can't read tree block %ld\n", bnum);
+
+    if (node->hdr.magic != EXTENT_MAGIC)
+        myfs_die("extent: tree block %ld is bad (magic 0x%x)\n", bnum,
+                 node->hdr.magic);
+
+    return node;
+}
+
+
+/* bnum 0 is the root, which lives in the inode */
+static void
+put_node(myfs_info *myfs, fs_off_t bnum, int dirty)
+{
+    if (bnum == 0)
+        return;
+
+    if (dirty)
+        mark_blocks_dirty(myfs->fd, bnum, 1);
+    release_block(myfs->fd, bnum);
+}
+
+
+static fs_off_t
+new_node(myfs_info *myfs, fs_off_t goal, int depth, extent_node **node)
+{
+    int       bsize = myfs->dsb.block_size;
+    fs_off_t  nblocks = 1, bnum;
+
+    if (myfs_allocate_blocks(myfs, NULL, goal, &nblocks, &bnum,
+                             LOOSE_ALLOCATION) != 0 || bnum < 0)
+        return -1;
+
+    *node = (extent_node *)get_empty_block(myfs->fd, bnum, bsize);
+    if (*node == NULL)
+        myfs_die("extent: can't get a new tree block %ld\n", bnum);
+
+    memset(*node, 0, bsize);
+    (*node)->hdr.magic = EXTENT_MAGIC;
+    (*node)->hdr.max   = (bsize - sizeof(extent_header)) / sizeof(file_extent);
+    (*node)->hdr.depth = depth;
+
+    myfs->extent_nodes++;
+
+    return bnum;
+}
+
+
+/* the last entry that starts at or before lblock, -1 if there isn't one */
+static int
+find_slot(extent_node *node, fs_off_t lblock)
+{
+    int lo = 0, hi = node->hdr.count - 1, mid;
+
+    while(lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (node->ext[mid].lblock <= lblock)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+
+    return hi;
+}
+
+
+/* the leaf lblock belongs in.  *bnum is 0 if that's the root. */
+static extent_node *
+find_leaf(myfs_info *myfs, extent_node *node, fs_off_t lblock,
+          fs_off_t *bnum)
+{
+    int       i;
+    fs_off_t  cur = 0, child;
+
+    while(node->hdr.depth > 0) {
+        i = find_slot(node, lblock);
+        if (i < 0)
+            i = 0;
+
+        child = node->ext[i].pblock;
+        put_node(myfs, cur, 0);
+
+        node = get_node(myfs, child);
+        cur  = child;
+    }
+
+    *bnum = cur;
+    return node;
+}
+
+
+static void
+node_insert(extent_node *node, int i, file_extent *e)
+{
+    memmove(&node->ext[i + 1], &node->ext[i],
+            (node->hdr.count - i) * sizeof(file_extent));
+    node->ext[i] = *e;
+    node->hdr.count++;
+}
+
+
+static void
+node_remove(extent_node *node, int i)
+{
+    node->hdr.count--;
+    memmove(&node->ext[i], &node->ext[i + 1],
+            (node->hdr.count - i) * sizeof(file_extent));
+}
+
+
+/*
+  put e at position i of node.  a full tree block is split and the new
+  right half comes back in *split for the parent to add.  appending
+  (the usual case) leaves the left half full.  a full root can't be
+  split so everything in it moves down to a new block instead and the
+  tree gets one level deeper.
+*/
+static int
+add_entry(myfs_info *myfs, extent_node *node, fs_off_t bnum, int i,
+          file_extent *e, file_extent *split, int *did_split)
+{
+    int          count = node->hdr.count, half;
+    fs_off_t     nb;
+    extent_node *right;
+
+    if (count < node->hdr.max) {
+        node_insert(node, i, e);
+        return 0;
+    }
+
+    if (bnum == 0) {
+        nb = new_node(myfs, node->ext[0].pblock, node->hdr.depth, &right);
+        if (nb < 0)
+            return ENOSPC;
+
+        memcpy(right->ext, node->ext, count * sizeof(file_extent));
+        right->hdr.count = count;
+        node_insert(right, i, e);
+
+        node->hdr.depth++;
+        node->hdr.count     = 1;
+        node->ext[0].lblock = right->ext[0].lblock;
+        node->ext[0].len    = 0;
+        node->ext[0].pblock = nb;
+
+        put_node(myfs, nb, 1);
+        return 0;
+    }
+
+    nb = new_node(myfs, bnum, node->hdr.depth, &right);
+    if (nb < 0)
+        return ENOSPC;
+
+    half = (i == count) ? count : count / 2;
+
+    memcpy(right->ext, &node->ext[half], (count - half) * sizeof(file_extent));
+    right->hdr.count = count - half;
+    node->hdr.count  = half;
+
+    if (i <= half && half < count)
+        node_insert(node, i, e);
+    else
+        node_insert(right, i - half, e);
+
+    split->lblock = right->ext[0].lblock;
+    split->len    = 0;
+    split->pblock = nb;
+    *did_split    = 1;
+
+    put_node(myfs, nb, 1);
+
+    return 0;
+}
+
+
+static int
+insert_rec(myfs_info *myfs, extent_node *node, fs_off_t bnum, file_extent *e,
+           file_extent *split, int *did_split)
+{
+    int          i, err, child_split = 0;
+    fs_off_t     cbnum;
+    file_extent  new_entry;
+    extent_node *child;
+
+    *did_split = 0;
+    i = find_slot(node, e->lblock);
+
+    if (node->hdr.depth == 0)
+        return add_entry(myfs, node, bnum, i + 1, e, split, did_split);
+
+    if (i < 0) {                  /* it goes before everything else */
+        i = 0;
+        node->ext[0].lblock = e->lblock;
+    }
+
+    cbnum = node->ext[i].pblock;
+    child = get_node(myfs, cbnum);
+    err = insert_rec(myfs, child, cbnum, e, &new_entry, &child_split);
+    put_node(myfs, cbnum, 1);
+
+    if (err != 0 || child_split == 0)
+        return err;
+
+    return add_entry(myfs, node, bnum, i + 1, &new_entry, split, did_split);
+}
+
+
+/*
+  an insert can split a block at every level and then push the root
+  down.  the blocks for that are checked for first so it never runs out
+  half way with entries already moved to a block nothing points at.
+*/
+#define INSERT_BLOCKS(root)  ((root)->hdr.depth + 2)
+
+static int
+insert_extent(myfs_info *myfs, data_stream *ds, file_extent *e)
+{
+    int          did_split;
+    file_extent  split;
+    extent_node *root = root_node(ds);
+
+    if (NUM_AVAIL_BLOCKS(myfs) < INSERT_BLOCKS(root))
+        return ENOSPC;
+
+    return insert_rec(myfs, root, 0, e, &split, &did_split);
+}
+
+
+/* find the extent that maps lblock.  returns 1 if there is one. */
+int
+extent_lookup(myfs_info *myfs, data_stream *ds, fs_off_t lblock,
+              file_extent *ext)
+{
+    int          i, found = 0;
+    fs_off_t     bnum;
+    extent_node *leaf;
+
+    leaf = find_leaf(myfs, root_node(ds), lblock, &bnum);
+
+    i = find_slot(leaf, lblock);
+    if (i >= 0 && lblock < leaf->ext[i].lblock + EXT_LEN(&leaf->ext[i])) {
+        *ext  = leaf->ext[i];
+        found = 1;
+    }
+
+    put_node(myfs, bnum, 0);
+
+    return found;
+}
+
+
+/*
+  map len more blocks of a file, starting at file block lblock, to the
+  run at pblock.  if they carry on from the extent before them (on disk
+  too) that one just gets longer.
+*/
+int
+extent_append(myfs_info *myfs, data_stream *ds, fs_off_t lblock,
+              fs_off_t pblock, fs_off_t len, uint32 flags)
+{
+    int          i, err = 0;
+    fs_off_t     bnum, n;
+    file_extent *prev, e;
+    extent_node *leaf;
+
+    if (lblock + len > EXTENT_MAX_BLOCKS)
+        return E2BIG;
+
+    leaf = find_leaf(myfs, root_node(ds), lblock, &bnum);
+
+    i = find_slot(leaf, lblock);
+    if (i >= 0) {
+        prev = &leaf->ext[i];
+        if (prev->lblock + EXT_LEN(prev) == lblock &&
+            prev->pblock + EXT_LEN(prev) == pblock &&
+            (prev->len & EXTENT_UNWRITTEN) == flags &&
+            EXT_LEN(prev) + len <= EXTENT_MAX_LEN) {
+            prev->len += len;
+            put_node(myfs, bnum, 1);
+            return 0;
+        }
+    }
+
+    put_node(myfs, bnum, 0);
+
+    for(; err == 0 && len > 0; lblock += n, pblock += n, len -= n) {
+        n = (len > EXTENT_MAX_LEN) ? EXTENT_MAX_LEN : len;
+
+        e.lblock = lblock;
+        e.len    = n | flags;
+        e.pblock = pblock;
+        err = insert_extent(myfs, ds, &e);
+    }
+
+    return err;
+}
+
+
+/* can b be tacked onto the end of written extent a? */
+#define CAN_MERGE(a, b)                                                 \
+    (((a)->len & EXTENT_UNWRITTEN) == 0 &&                              \
+     (a)->lblock + (a)->len == (b)->lblock &&                           \
+     (a)->pblock + (a)->len == (b)->pblock &&                           \
+     (a)->len + EXT_LEN(b) <= EXTENT_MAX_LEN)
+
+
+/*
+  lblock of a preallocated extent is about to be written.  it gets
+  split off into a written extent of its own, or added onto a written
+  neighbour in the same leaf when it's contiguous with one.  extents
+  in different leaves aren't merged, that would mean fixing up the
+  index above them.
+*/
+int
+extent_mark_written(myfs_info *myfs, data_stream *ds, fs_off_t lblock)
+{
+    int          i, n = 0, err = 0;
+    fs_off_t     bnum, len, off;
+    file_extent *e, *prev, *next, ins[2];
+    extent_node *root = root_node(ds), *leaf;
+
+    /* there may be two extents to add: don't change anything if we can't */
+    if (NUM_AVAIL_BLOCKS(myfs) < 2 * INSERT_BLOCKS(root))
+        return ENOSPC;
+
+    leaf = find_leaf(myfs, root, lblock, &bnum);
+
+    i = find_slot(leaf, lblock);
+    if (i < 0 || lblock >= leaf->ext[i].lblock + EXT_LEN(&leaf->ext[i]) ||
+        (leaf->ext[i].len & EXTENT_UNWRITTEN) == 0) {
+        put_node(myfs, bnum, 0);
+        return 0;
+    }
+
+    e    = &leaf->ext[i];
+    prev = (i > 0) ? &leaf->ext[i - 1] : NULL;
+    next = (i + 1 < leaf->hdr.count) ? &leaf->ext[i + 1] : NULL;
+    len  = EXT_LEN(e);
+    off  = lblock - e->lblock;
+
+    if (len == 1) {
+        e->len = 1;
+        if (next && CAN_MERGE(e, next)) {
+            e->len += next->len;
+            node_remove(leaf, i + 1);
+        }
+        if (prev && CAN_MERGE(prev, e)) {
+            prev->len += e->len;
+            node_remove(leaf, i);
+        }
+    } else if (off == 0 && prev && prev->len < EXTENT_MAX_LEN &&
+               CAN_MERGE(prev, e)) {
+        prev->len++;
+        e->lblock++;
+        e->pblock++;
+        e->len--;
+    } else if (off == len - 1 && next && (next->len & EXTENT_UNWRITTEN) == 0 &&
+               next->len < EXTENT_MAX_LEN &&
+               e->lblock + len == next->lblock &&
+               e->pblock + len == next->pblock) {
+        next->lblock--;
+        next->pblock--;
+        next->len++;
+        e->len = off | EXTENT_UNWRITTEN;
+    } else if (off == 0) {
+        ins[n].lblock = lblock + 1;
+        ins[n].len    = (len - 1) | EXTENT_UNWRITTEN;
+        ins[n].pblock = e->pblock + 1;
+        n++;
+        e->len = 1;
+    } else {
+        ins[n].lblock = lblock;
+        ins[n].len    = 1;
+        ins[n].pblock = e->pblock + off;
+        n++;
+        if (len - off - 1 > 0) {
+            ins[n].lblock = lblock + 1;
+            ins[n].len    = (len - off - 1) | EXTENT_UNWRITTEN;
+            ins[n].pblock = e->pblock + off + 1;
+            n++;
+        }
+        e->len = off | EXTENT_UNWRITTEN;
+    }
+
+    put_node(myfs, bnum, 1);
+
+    for(i=0; err == 0 && i < n; i++)
+        err = insert_extent(myfs, ds, &ins[i]);
+
+    return err;
+}
+
+
+/*
+  free everything at or past file block nblocks under node: whole
+  extents at a time, and tree blocks that end up empty.  returns how
+  many entries are left.
+*/
+static int
+trim_node(myfs_info *myfs, extent_node *node, fs_off_t nblocks)
+{
+    int          i;
+    fs_off_t     end;
+    file_extent *e;
+    extent_node *child;
+
+    for(i=node->hdr.count - 1; i >= 0; i--) {
+        e = &node->ext[i];
+
+        if (node->hdr.depth == 0) {
+            end = e->lblock + EXT_LEN(e);
+
+            if (e->lblock >= nblocks) {
+                if (myfs_free_blocks(myfs, e->pblock, EXT_LEN(e)) != 0)
+                    printf("extent: error freeing %ld:%ld\n",
+                           (long)e->pblock, (long)EXT_LEN(e));
+                node->hdr.count--;
+                continue;
+            }
+
+            if (end > nblocks) {
+                if (myfs_free_blocks(myfs, e->pblock + nblocks - e->lblock,
+                                     end - nblocks) != 0)
+                    printf("extent: error freeing %ld:%ld\n",
+                           (long)(e->pblock + nblocks - e->lblock),
+                           (long)(end - nblocks));
+                e->len = (nblocks - e->lblock) | (e->len & EXTENT_UNWRITTEN);
+            }
+            break;
+        }
+
+        child = get_node(myfs, e->pblock);
+        if (trim_node(myfs, child, nblocks) == 0) {
+            put_node(myfs, e->pblock, 0);
+            myfs_free_blocks(myfs, e->pblock, 1);
+            node->hdr.count--;
+            continue;
+        }
+
+        put_node(myfs, e->pblock, 1);
+        break;
+    }
+
+    return node->hdr.count;
+}
+
+
+/* cut a file's extents down to its first nblocks blocks */
+int
+extent_truncate(myfs_info *myfs, data_stream *ds, fs_off_t nblocks)
+{
+    fs_off_t     bnum;
+    extent_node *root = root_node(ds), *child;
+
+    trim_node(myfs, root, nblocks);
+
+    /* a tree that fits back in the inode moves back up */
+    while(root->hdr.depth > 0 && root->hdr.count <= 1) {
+        if (root->hdr.count == 0) {
+            root->hdr.depth = 0;
+            break;
+        }
+
+        bnum  = root->ext[0].pblock;
+        child = get_node(myfs, bnum);
+        if (child->hdr.count > root->hdr.max) {
+            put_node(myfs, bnum, 0);
+            break;
+        }
+
+        memcpy(root->ext, child->ext, child->hdr.count * sizeof(file_extent));
+        root->hdr.count = child->hdr.count;
+        root->hdr.depth = child->hdr.depth;
+
+        put_node(myfs, bnum, 0);
+        myfs_free_blocks(myfs, bnum, 1);
+    }
+
+    return 0;
+}
+
+
+static int
+walk_node(myfs_info *myfs, extent_node *node,
+          int (*func)(myfs_info *myfs, file_extent *e, void *arg), void *arg)
+{
+    int          i, err = 0;
+    extent_node *child;
+
+    for(i=0; err == 0 && i < node->hdr.count; i++) {
+        if (node->hdr.depth == 0) {
+            err = func(myfs, &node->ext[i], arg);
+        } else {
+            child = get_node(myfs, node->ext[i].pblock);
+            err = walk_node(myfs, child, func, arg);
+            put_node(myfs, node->ext[i].pblock, 0);
+        }
+    }
+
+    return err;
+}
+
+
+/* call func on every extent of a file in order, until it returns non-zero */
+int
+extent_walk(myfs_info *myfs, data_stream *ds,
+            int (*func)(myfs_info *myfs, file_extent *e, void *arg),
+            void *arg)
+{
+    return walk_node(myfs, root_node(ds), func, arg);
+}
+
+
+int
+extent_depth(data_stream *ds)
+{
+    return root_node(ds)->hdr.depth;
+}
+
+
+static void
+flush_node(myfs_info *myfs, extent_node *node)
+{
+    int          i;
+    fs_off_t     bnum;
+    extent_node *child;
+
+    if (node->hdr.depth == 0)
+        return;
+
+    for(i=0; i < node->hdr.count; i++) {
+        bnum  = node->ext[i].pblock;
+        child = get_node(myfs, bnum);
+        flush_node(myfs, child);
+        put_node(myfs, bnum, 0);
+
+        flush_blocks(myfs->fd, bnum, 1);
+    }
+}
+
+
+/* get all of a file's tree blocks on disk (before an inode points at them) */
+void
+extent_flush_tree(myfs_info *myfs, data_stream *ds)
+{
+    flush_node(myfs, root_node(ds));
+}
@@ -0,0 +1,52 @@
+#ifndef _EXTENT_H
+#define _EXTENT_H
+
+/*
+  with MYFS_FEATURE_EXTENT_MAP a file's blocks are mapped by extents
+  instead of block pointers.  the direct/indirect part of its
+  data_stream holds the root of a b+tree of them: a few extents right
+  in the inode and, once those run out, index entries pointing at tree
+  blocks.  see extent.c.
+*/
+typedef struct file_extent {
+    uint32    lblock;       /* first block of the file it maps */
+    uint32    len;          /* how many, EXTENT_UNWRITTEN if preallocated */
+    fs_off_t  pblock;       /* where they are (or the child tree block) */
+} file_extent;
+
+typedef struct extent_header {
+    uint16    magic;
+    uint16    count;        /* entries in use */
+    uint16    max;          /* entries that fit */
+    uint16    depth;        /* 0 means the entries are extents */
+} extent_header;
+
+typedef struct extent_node {
+    extent_header  hdr;
+    file_extent    ext[1];  /* really hdr.max of them */
+} extent_node;
+
+#define EXTENT_MAGIC       0x4578
+#define EXTENT_UNWRITTEN   0x80000000   /* reads as zeros until written */
+#define EXTENT_MAX_LEN     0x7fffffff
+#define EXTENT_MAX_BLOCKS  ((fs_off_t)0xffffffff)
+#define EXT_LEN(e)         ((e)->len & ~EXTENT_UNWRITTEN)
+
+#define NUM_ROOT_EXTENTS   ((offsetof(data_stream, size) -                  \
+                             sizeof(extent_header)) / sizeof(file_extent))
+
+#define EXTENT_MAPPED(x)   ((x)->dsb.features & MYFS_FEATURE_EXTENT_MAP)
+
+int  extent_lookup(myfs_info *myfs, data_stream *ds, fs_off_t lblock,
+                   file_extent *ext);
+int  extent_append(myfs_info *myfs, data_stream *ds, fs_off_t lblock,
+                   fs_off_t pblock, fs_off_t len, uint32 flags);
+int  extent_mark_written(myfs_info *myfs, data_stream *ds, fs_off_t lblock);
+int  extent_truncate(myfs_info *myfs, data_stream *ds, fs_off_t nblocks);
+int  extent_walk(myfs_info *myfs, data_stream *ds,
+                 int (*func)(myfs_info *myfs, file_extent *e, void *arg),
+                 void *arg);
+int  extent_depth(data_stream *ds);
+void extent_flush_tree(myfs_info *myfs, data_stream *ds);
+
+#endif /* _EXTENT_H */
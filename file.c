@@ -20,48 +20,40 @@ myfs_read_vnode(void *ns, vnode_id vnid, char r, void **node)
 {
     myfs_info  *myfs = (myfs_info *)ns;
     myfs_inode *mi;
-    int         bsize = myfs->dsb.block_size, offset;
-    char       *block;
-    char        tmp[IDENT_NAME_LENGTH];
-    fs_off_t    addr; 
-    my_ino_t    ia = (my_ino_t)vnid;
-    myfs_inode_etc *metc;
-    
-    mi = (myfs_inode *)malloc(sizeof(myfs_inode));
-    if (mi == NULL)
-        return ENOMEM;
+    inode_addr  ia = (inode_addr)vnid;
+    int         err;
 
-    metc = (myfs_inode_etc *)calloc(1, sizeof(myfs_inode_etc));
-    if (metc == NULL) {
-        free(mi);
-        return ENOMEM;
-    }   
+    err = myfs_load_inodes(myfs, &ia, 1, &mi);
+    if (err != 0)
+        return err;
 
-    addr = myfs->dsb.inodes_start + ((ia * sizeof(myfs_inode)) / bsize);
-    offset = (ia % (bsize / sizeof(myfs_inode))) * sizeof(myfs_inode);
+    *node = mi;
+    return 0;
+}
 
-    block = get_block(myfs->fd, addr, bsize);
-    if (block == NULL) {
-        printf("couldn't read inode block at block #%ld", addr);
-        return EINVAL;
-    }
-    
-    memcpy(mi, &block[offset], sizeof(myfs_inode));
+/*
+  read several vnodes at once (see get_vnodes()).  sorted vnids let
+  myfs_load_inodes() decode each inode table block in one pass.
+*/
+int
+myfs_read_vnodes(void *ns, vnode_id *vnids, int n, char r, void **nodes)
+{
+    myfs_info  *myfs = (myfs_info *)ns;
+    inode_addr *ia;
+    int         i, err;
 
-    release_block(myfs->fd, addr);
+    ia = (inode_addr *)malloc(n * sizeof(inode_addr));
+    if (ia == NULL)
+        return ENOMEM;
 
-    mi->etc = metc;
+    for(i=0; i < n; i++)
+        ia[i] = (inode_addr)vnids[i];
 
-    CHECK_INODE(mi);    /* make sure it's not corrupt */
+    err = myfs_load_inodes(myfs, ia, n, (myfs_inode **)nodes);
 
-    sprintf(tmp, "ino#%ld", ia);
-    new_lock(&mi->etc->lock, tmp);
+    free(ia);
 
-    /* only directories use this. it is read on demmand so clear it for now */
-    mi->etc->contents = NULL;
-    
-    *node = mi;
-    return 0;
+    return err;
 }
 
 int
@@ -72,17 +64,11 @@ myfs_release_vnode(void *ns, void *node, char r)
 
     CHECK_INODE(mi);
 
-    free_lock(&mi->etc->lock);
-    
-    if (mi->etc->contents) {
-        free(mi->etc->contents);
-        mi->etc->contents = NULL;
-    }
+    myfs_flush_delalloc(myfs, mi);
+    myfs_release_window(myfs, mi);
+    myfs_write_inode(myfs, mi);
 
-    free(mi->etc);
-    mi->etc = NULL;
-    
-    free(mi);
+    myfs_put_inode(myfs, mi);
 
     return 0;
 }
@@ -99,14 +85,7 @@ myfs_remove_vnode(void *ns, void *node, char r)
     
     myfs_free_inode(myfs, mi->inode_num);
 
-    if (mi->etc->contents)
-        free(mi->etc->contents);
-    mi->etc->contents = NULL;      /* paranoia, it'll destroy ya */
-    
-    free(mi->etc);
-    mi->etc = NULL;
-    
-    free(mi);
+    myfs_put_inode(myfs, mi);
 
     return 0;
 }
@@ -176,7 +155,7 @@ myfs_create(void *ns, void *dir, const char *name,
         printf("create: failed to insert the new guy %s\n", name);
 
         myfs_free_inode(myfs, mi->inode_num);
-        free(mi);
+        myfs_put_inode(myfs, mi);
         
         return ret;
     }
@@ -184,6 +163,8 @@ myfs_create(void *ns, void *dir, const char *name,
     *vnid   = (vnode_id)mi->inode_num;
     *cookie = NULL;
 
+    mi->etc->opens++;           /* creating it opens it too */
+
     if ((err = new_vnode(myfs->nsid, *vnid, mi)) != 0)
         myfs_die("new_vnode failed for vnid %ld: %s\n", *vnid, strerror(err));
 
@@ -268,6 +249,8 @@ myfs_open(void *ns, void *node, int omode, void **cookie)
 
     CHECK_INODE(mi);
 
+    mi->etc->opens++;
+
     return 0;
 }
 
@@ -279,6 +262,13 @@ myfs_close(void *ns, void *node, void *cookie)
 
     CHECK_INODE(mi);
 
+    /* the last close gives back whatever is left of its window */
+    if (--mi->etc->opens <= 0) {
+        mi->etc->opens = 0;
+        myfs_release_window(myfs, mi);
+        myfs_write_inode(myfs, mi);
+    }
+
     return 0;
 }
 
@@ -317,6 +307,30 @@ myfs_write(void *ns, void *node, void *cookie, fs_off_t pos,
     return myfs_write_data_stream(myfs, mi, pos, buf, len);
 }
 
+int
+myfs_readv(void *ns, void *node, void *cookie, fs_off_t pos,
+           const struct iovec *vec, size_t count, size_t *len)
+{
+    myfs_info  *myfs = (myfs_info *)ns;
+    myfs_inode *mi   = (myfs_inode *)node;
+
+    CHECK_INODE(mi);
+
+    return myfs_read_data_stream_vecs(myfs, mi, pos, vec, count, len);
+}
+
+int
+myfs_writev(void *ns, void *node, void *cookie, fs_off_t pos,
+            const struct iovec *vec, size_t count, size_t *len)
+{
+    myfs_info  *myfs = (myfs_info *)ns;
+    myfs_inode *mi   = (myfs_inode *)node;
+
+    CHECK_INODE(mi);
+
+    return myfs_write_data_stream_vecs(myfs, mi, pos, vec, count, len);
+}
+
 int
 myfs_ioctl(void *ns, void *node, void *cookie, int cmd, void *buf, size_t len)
 {
@@ -325,9 +339,31 @@ myfs_ioctl(void *ns, void *node, void *cookie, int cmd, void *buf, size_t len)
 
     CHECK_INODE(mi);
 
+    switch (cmd) {
+    case MYFS_IOCTL_COUNT_EXTENTS:
+        if (buf == NULL || len < sizeof(int))
+            return EINVAL;
+        return myfs_count_extents(myfs, mi, (int *)buf);
+
+    case MYFS_IOCTL_RELOCATE:
+        return myfs_relocate_data_stream(myfs, mi);
+    }
+
     return EINVAL;
 }
 
+int
+myfs_fallocate(void *ns, void *node, void *cookie, int mode,
+               fs_off_t pos, fs_off_t len)
+{
+    myfs_info  *myfs = (myfs_info *)ns;
+    myfs_inode *mi   = (myfs_inode *)node;
+
+    CHECK_INODE(mi);
+
+    return myfs_preallocate(myfs, mi, mode, pos, len);
+}
+
 
 int
 myfs_rstat(void *ns, void *node, struct my_stat *st)
@@ -412,9 +448,13 @@ myfs_fsync(void *ns, void *node)
 {
     myfs_info  *myfs = (myfs_info *)ns;
     myfs_inode *mi   = (myfs_inode *)node;
+    int         err;
 
     CHECK_INODE(mi);
 
-    return 0;
+    err = myfs_flush_delalloc(myfs, mi);
+    myfs_write_inode(myfs, mi);
+
+    return err;
 }
 
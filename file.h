@@ -1,5 +1,6 @@
 
 int myfs_read_vnode(void *ns, vnode_id vnid, char r, void **node);
+int myfs_read_vnodes(void *ns, vnode_id *vnids, int n, char r, void **nodes);
 int myfs_release_vnode(void *ns, void *node, char renter);
 int myfs_remove_vnode(void *ns, void *node, char renter);
 int myfs_walk(void *ns, void *base, const char *file,
@@ -21,8 +22,14 @@ int myfs_read(void *ns, void *node, void *cookie, fs_off_t pos, void *buf,
               size_t *len);
 int myfs_write(void *ns, void *node, void *cookie, fs_off_t pos,
                const void *buf, size_t *len);
+int myfs_readv(void *ns, void *node, void *cookie, fs_off_t pos,
+               const struct iovec *vec, size_t count, size_t *len);
+int myfs_writev(void *ns, void *node, void *cookie, fs_off_t pos,
+                const struct iovec *vec, size_t count, size_t *len);
 int myfs_ioctl(void *ns, void *node, void *cookie, int cmd,
                void *buf, size_t len);
+int myfs_fallocate(void *ns, void *node, void *cookie, int mode,
+                   fs_off_t pos, fs_off_t len);
 int myfs_rstat(void *ns, void *node, struct my_stat *st);
 int myfs_wstat(void *ns, void *node, struct my_stat *st, long mask);
 int myfs_fsync(void *ns, void *node);
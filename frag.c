@@ -0,0 +1,148 @@
+/*
+  This file contains a fragmentation report and an online defragmenter.
+  Both the "defrag" program and fsh's defrag command use it.
+
+  It works on a mounted volume through the regular system calls.  It
+  walks the directory tree and asks each regular file how many extents
+  it is in (MYFS_IOCTL_COUNT_EXTENTS).  A file in more than one extent
+  can be handed back to the file system to be rewritten into a single
+  run (MYFS_IOCTL_RELOCATE).  The free space report is a histogram of
+  the sizes of the free runs in the block bitmap.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "myfs.h"
+#include "kprotos.h"
+#include "frag.h"
+
+
+static int
+frag_file(const char *name, struct my_stat *sbuf, int flags, frag_stats *st)
+{
+    int  fd, err, before, after;
+
+    fd = sys_open(1, -1, name, O_RDWR, 0, 0);
+    if (fd < 0)
+        return fd;
+
+    err = sys_ioctl(1, fd, MYFS_IOCTL_COUNT_EXTENTS, &before, sizeof(before));
+    if (err != 0)
+        goto out;
+
+    after = before;
+    if (before > 1 && (flags & FRAG_MOVE)) {
+        if (sys_ioctl(1, fd, MYFS_IOCTL_RELOCATE, NULL, 0) == 0 &&
+            sys_ioctl(1, fd, MYFS_IOCTL_COUNT_EXTENTS, &after,
+                      sizeof(after)) == 0) {
+            st->moved++;
+        } else {
+            st->failed++;      /* most likely no free run big enough */
+        }
+    }
+
+    st->files++;
+    st->extents       += before;
+    st->extents_after += after;
+    if (before > 1)
+        st->fragmented++;
+
+    if (flags & FRAG_VERBOSE) {
+        if (after != before)
+            printf("%8ld %10ld  %4d -> %d  %s\n", (long)sbuf->ino,
+                   (long)sbuf->size, before, after, name);
+        else
+            printf("%8ld %10ld  %4d       %s\n", (long)sbuf->ino,
+                   (long)sbuf->size, before, name);
+    }
+
+ out:
+    sys_close(1, fd);
+
+    return err;
+}
+
+
+/*
+  look at (and with FRAG_MOVE, defragment) every regular file under
+  path.  directories are done as they're found so there's only ever
+  one open per level of the tree.
+*/
+int
+frag_walk(const char *path, int flags, frag_stats *st)
+{
+    int               dirfd, err;
+    char              name[512], buff[512];
+    struct my_dirent *dent = (struct my_dirent *)buff;
+    struct my_stat    sbuf;
+
+    if ((dirfd = sys_opendir(1, -1, path, 0)) < 0) {
+        printf("frag: error opening: %s\n", path);
+        return dirfd;
+    }
+
+    while((err = sys_readdir(1, dirfd, dent, sizeof(buff), 1)) > 0) {
+        if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            continue;
+
+        if (snprintf(name, sizeof(name), "%s/%s", path,
+                     dent->d_name) >= (int)sizeof(name)) {
+            st->skipped++;     /* too deep for us to name it */
+            continue;
+        }
+        if (sys_rstat(1, -1, name, &sbuf, 0) != 0)
+            continue;
+
+        if (MY_S_ISDIR(sbuf.mode))
+            frag_walk(name, flags, st);
+        else if (MY_S_ISREG(sbuf.mode))
+            frag_file(name, &sbuf, flags, st);
+    }
+
+    sys_closedir(1, dirfd);
+
+    return (err < 0) ? err : 0;
+}
+
+
+void
+frag_print_stats(frag_stats *st)
+{
+    int n = st->files ? st->files : 1;
+
+    printf("%d files, %d fragmented, %ld.%.2ld extents per file",
+           st->files, st->fragmented, st->extents / n,
+           (st->extents * 100 / n) % 100);
+    if (st->moved || st->failed)
+        printf(" (%ld.%.2ld after), %d moved, %d couldn't be",
+               st->extents_after / n, (st->extents_after * 100 / n) % 100,
+               st->moved, st->failed);
+    if (st->skipped)
+        printf(", %d skipped (path too long)", st->skipped);
+    printf("\n");
+}
+
+
+void
+frag_print_free_space(myfs_info *myfs)
+{
+    int   i, runs;
+    long  hist[FRAG_BUCKETS];
+
+    runs = myfs_free_run_histogram(myfs, hist, FRAG_BUCKETS);
+
+    printf("%ld free blocks in %d runs\n", (long)NUM_FREE_BLOCKS(myfs), runs);
+    for(i=0; i < FRAG_BUCKETS; i++) {
+        if (hist[i] == 0)
+            continue;
+
+        if (i == 0)
+            printf("  %5d       blocks: %6ld\n", 1, hist[i]);
+        else if (i == FRAG_BUCKETS - 1)
+            printf("  %5d+      blocks: %6ld\n", 1 << i, hist[i]);
+        else
+            printf("  %5d-%-5d blocks: %6ld\n", 1 << i, (2 << i) - 1,
+                   hist[i]);
+    }
+}
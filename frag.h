@@ -0,0 +1,28 @@
+#ifndef _FRAG_H
+#define _FRAG_H
+
+/*
+  the fragmentation report and defragmenter shared by the "defrag"
+  program and fsh's defrag command (see frag.c).
+*/
+
+#define FRAG_MOVE     0x0001   /* rewrite fragmented files into one run */
+#define FRAG_VERBOSE  0x0002   /* print a line for every file */
+
+#define FRAG_BUCKETS  12       /* free run sizes 1, 2-3, 4-7 ... 2048+ */
+
+typedef struct frag_stats {
+    int    files;              /* regular files looked at */
+    int    fragmented;         /* ones in more than one extent */
+    long   extents;            /* extents in all of them, before */
+    long   extents_after;      /* and after any moving */
+    int    moved;              /* files rewritten into a single run */
+    int    failed;             /* fragmented files that couldn't be */
+    int    skipped;            /* entries whose path was too long */
+} frag_stats;
+
+int   frag_walk(const char *path, int flags, frag_stats *st);
+void  frag_print_stats(frag_stats *st);
+void  frag_print_free_space(myfs_info *myfs);
+
+#endif /* _FRAG_H */
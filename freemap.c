@@ -0,0 +1,353 @@
+/*
+  This file contains an extent based map of free blocks.  It is an
+  alternative to searching the block bitmap: each run of free blocks
+  is one free_extent, kept in one skip list ordered by starting block
+  and in another ordered by length.  Allocation is best-fit (or as
+  close to a goal block as possible) and freeing coalesces with the
+  neighboring extents, so the lists always hold maximal runs.
+
+  The map itself is not written to disk.  bitmap.c keeps the bitmap
+  up to date as well and the map gets rebuilt from it at mount time.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "myfs.h"
+#include "skiplist.h"
+
+
+struct free_map
+{
+    SkipList   by_start;      /* ordered by start block */
+    SkipList   by_len;        /* ordered by length, then start block */
+    fs_off_t   free_blocks;
+};
+
+
+static int
+compare_start(free_extent *a, free_extent *b)
+{
+    if (a->start < b->start)
+        return -1;
+    else if (a->start > b->start)
+        return 1;
+
+    return 0;
+}
+
+
+static int
+compare_len(free_extent *a, free_extent *b)
+{
+    if (a->len < b->len)
+        return -1;
+    else if (a->len > b->len)
+        return 1;
+
+    return compare_start(a, b);
+}
+
+
+free_map *
+new_free_map(void)
+{
+    free_map *fm;
+
+    fm = (free_map *)calloc(1, sizeof(free_map));
+    if (fm == NULL)
+        return NULL;
+
+    fm->by_start = NewSL(compare_start, NULL, NO_DUPLICATES);
+    fm->by_len   = NewSL(compare_len, NULL, NO_DUPLICATES);
+    if (fm->by_start == NULL || fm->by_len == NULL) {
+        delete_free_map(fm);
+        return NULL;
+    }
+
+    return fm;
+}
+
+
+static int
+free_extent_item(free_extent *fe, void *arg)
+{
+    free(fe);
+    return SL_CONTINUE;
+}
+
+
+void
+delete_free_map(free_map *fm)
+{
+    if (fm == NULL)
+        return;
+
+    if (fm->by_len)
+        FreeSL(fm->by_len);
+
+    if (fm->by_start) {
+        DoForSL(fm->by_start, free_extent_item, NULL);
+        FreeSL(fm->by_start);
+    }
+
+    free(fm);
+}
+
+
+static int
+insert_extent(free_map *fm, fs_off_t start, fs_off_t len)
+{
+    free_extent *fe;
+
+    fe = (free_extent *)malloc(sizeof(free_extent));
+    if (fe == NULL)
+        return ENOMEM;
+
+    fe->start = start;
+    fe->len   = len;
+
+    if (InsertSL(fm->by_start, fe) != TRUE) {
+        free(fe);
+        return ENOMEM;
+    }
+
+    if (InsertSL(fm->by_len, fe) != TRUE) {
+        DeleteSL(fm->by_start, fe);
+        free(fe);
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+
+/*
+  change the size of an extent.  it has to come out of the length list
+  while it changes because its position there depends on its length.
+  the start block can move too, as long as it doesn't pass a neighbor.
+*/
+static int
+resize_extent(free_map *fm, free_extent *fe, fs_off_t start, fs_off_t len)
+{
+    DeleteSL(fm->by_len, fe);
+
+    if (len == 0) {
+        DeleteSL(fm->by_start, fe);
+        free(fe);
+        return 0;
+    }
+
+    fe->start = start;
+    fe->len   = len;
+
+    if (InsertSL(fm->by_len, fe) != TRUE) {
+        DeleteSL(fm->by_start, fe);
+        free(fe);
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+
+/* return the extent that contains block, if there is one */
+static free_extent *
+find_extent(free_map *fm, fs_off_t block)
+{
+    free_extent key, *fe;
+
+    key.start = block + 1;
+    fe = (free_extent *)SearchLTSL(fm->by_start, &key);
+    if (fe && fe->start + fe->len > block)
+        return fe;
+
+    return NULL;
+}
+
+
+/* mark len blocks at start as free, merging with the extents around them */
+int
+free_map_add(free_map *fm, fs_off_t start, fs_off_t len)
+{
+    free_extent  key, *prev, *next;
+    int          err;
+
+    if (len <= 0)
+        return EINVAL;
+
+    key.start = start;
+    prev = (free_extent *)SearchLTSL(fm->by_start, &key);
+    next = (free_extent *)SearchGESL(fm->by_start, &key);
+
+    if ((prev && prev->start + prev->len > start) ||
+        (next && next->start < start + len)) {
+        printf("free_map: freeing %ld:%ld but it's already free\n",
+               (long)start, (long)len);
+        return EINVAL;
+    }
+
+    if (prev && prev->start + prev->len != start)
+        prev = NULL;
+    if (next && start + len != next->start)
+        next = NULL;
+
+    if (prev && next) {
+        fs_off_t next_len = next->len;
+
+        err = resize_extent(fm, next, next->start, 0);
+        if (err == 0)
+            err = resize_extent(fm, prev, prev->start,
+                                prev->len + len + next_len);
+    } else if (prev) {
+        err = resize_extent(fm, prev, prev->start, prev->len + len);
+    } else if (next) {
+        err = resize_extent(fm, next, start, next->len + len);
+    } else {
+        err = insert_extent(fm, start, len);
+    }
+
+    if (err == 0)
+        fm->free_blocks += len;
+
+    return err;
+}
+
+
+/* take len blocks at start out of extent fe, which contains them */
+static int
+carve_extent(free_map *fm, free_extent *fe, fs_off_t start, fs_off_t len)
+{
+    fs_off_t head, tail;
+    int      err;
+
+    head = start - fe->start;
+    tail = (fe->start + fe->len) - (start + len);
+
+    if (head > 0) {
+        err = resize_extent(fm, fe, fe->start, head);
+        if (err == 0 && tail > 0)
+            err = insert_extent(fm, start + len, tail);
+    } else {
+        err = resize_extent(fm, fe, start + len, tail);
+    }
+
+    if (err == 0)
+        fm->free_blocks -= len;
+
+    return err;
+}
+
+
+/*
+  allocate len blocks.  if goal is a valid block we first try to put
+  the run right at goal.  after that we look for an extent of at least
+  want blocks (so the run has room to grow), first the one after goal
+  and then the smallest one anywhere, and then for the smallest extent
+  that holds len.  unless exact is EXACT_ALLOCATION, a request that
+  nothing can satisfy gets the biggest extent there is instead and
+  *got says how much.
+*/
+int
+free_map_alloc(free_map *fm, fs_off_t goal, fs_off_t len, fs_off_t want,
+               int exact, fs_off_t *start, fs_off_t *got)
+{
+    free_extent  key, *fe = NULL;
+    fs_off_t     where = -1;
+    int          err;
+
+    if (len <= 0)
+        return EINVAL;
+
+    if (want < len)
+        want = len;
+
+    if (goal >= 0) {
+        fe = find_extent(fm, goal);
+        if (fe && fe->start + fe->len - goal >= len) {
+            where = goal;
+        } else {
+            key.start = goal;
+            fe = (free_extent *)SearchGESL(fm->by_start, &key);
+            if (fe && fe->len >= want)
+                where = fe->start;
+        }
+    }
+
+    if (where == -1 && want > len) {
+        key.len   = want;
+        key.start = -1;
+        fe = (free_extent *)SearchGESL(fm->by_len, &key);
+        if (fe)
+            where = fe->start;
+    }
+
+    if (where == -1) {
+        key.len   = len;
+        key.start = -1;
+        fe = (free_extent *)SearchGESL(fm->by_len, &key);
+        if (fe == NULL && exact != EXACT_ALLOCATION) {
+            fe = (free_extent *)LastSL(fm->by_len);
+            if (fe)
+                len = fe->len;
+        }
+
+        if (fe == NULL)
+            return ENOSPC;
+
+        where = fe->start;
+    }
+
+    err = carve_extent(fm, fe, where, len);
+    if (err != 0)
+        return err;
+
+    *start = where;
+    *got   = len;
+
+    return 0;
+}
+
+
+/*
+  return 1 if all of start..start+len-1 are in use (state == 1) or all
+  free (state == 0), otherwise return 0.
+*/
+int
+free_map_check(free_map *fm, fs_off_t start, fs_off_t len, int state)
+{
+    free_extent key, *fe;
+
+    if (state == 0) {
+        fe = find_extent(fm, start);
+        return (fe && fe->start + fe->len >= start + len);
+    }
+
+    if (find_extent(fm, start))
+        return 0;
+
+    key.start = start;
+    fe = (free_extent *)SearchGESL(fm->by_start, &key);
+    if (fe && fe->start < start + len)
+        return 0;
+
+    return 1;
+}
+
+
+fs_off_t
+free_map_biggest(free_map *fm)
+{
+    free_extent *fe;
+
+    fe = (free_extent *)LastSL(fm->by_len);
+
+    return fe ? fe->len : 0;
+}
+
+
+int
+free_map_count(free_map *fm)
+{
+    return NumInSL(fm->by_start);
+}
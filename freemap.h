@@ -0,0 +1,30 @@
+#ifndef _FREEMAP_H
+#define _FREEMAP_H
+
+/*
+  a free map keeps the free space of a volume as extents (runs of free
+  blocks) in two skip lists: one ordered by starting block and one by
+  length.  the first gives near-goal allocation and coalescing on free,
+  the second gives best-fit allocation, both in O(log n).
+*/
+
+typedef struct free_extent
+{
+    fs_off_t   start;
+    fs_off_t   len;
+} free_extent;
+
+typedef struct free_map free_map;
+
+free_map *new_free_map(void);
+void      delete_free_map(free_map *fm);
+
+int       free_map_add(free_map *fm, fs_off_t start, fs_off_t len);
+int       free_map_alloc(free_map *fm, fs_off_t goal, fs_off_t len,
+                         fs_off_t want, int exact,
+                         fs_off_t *start, fs_off_t *got);
+int       free_map_check(free_map *fm, fs_off_t start, fs_off_t len,int state);
+fs_off_t  free_map_biggest(free_map *fm);
+int       free_map_count(free_map *fm);
+
+#endif /* _FREEMAP_H */
@@ -21,10 +21,14 @@
 
 #include "myfs.h"
 #include "kprotos.h"
+#include "ioring.h"
 #include "argv.h"
+#include "frag.h"
 
 static void do_fsh(void);
 
+static myfs_info *the_fs;
+
 int
 main(int argc, char **argv)
 {
@@ -43,6 +47,7 @@ main(int argc, char **argv)
     srand(seed);
 
     myfs = init_fs(disk_name);
+    the_fs = myfs;
 
     do_fsh();
 
@@ -260,15 +265,15 @@ mode_bits_to_str(int mode, char *str)
 static void
 do_dir(int argc, char **argv)
 {
-    int               dirfd, err, fd, max_err = 10;
-    char              dirname[128], buff[512], time_buf[64] = { '\0', };
-    size_t            len;
-    struct my_dirent *dent;
-    struct my_stat    st;
-    struct tm        *tm;
-    char              mode_str[16];
+    int                   dirfd, err, fd, i;
+    char                  dirname[128], time_buf[64] = { '\0', };
+    long long             buff[1024];
+    struct my_direntplus *dent;
+    struct my_stat       *st;
+    struct tm            *tm;
+    char                  mode_str[16];
     
-    dent = (struct my_dirent *)buff;
+    dent = (struct my_direntplus *)buff;
 
     strcpy(dirname, "/myfs/");
     if (argc > 1)
@@ -283,41 +288,41 @@ do_dir(int argc, char **argv)
     printf("      inode#  mode bits     uid    gid        size    "
            "Date      Name\n");
                   
+    /* readdirplus hands back the stat with each name, a bufferful at a time */
     while(1) {
-        len = 1;
-        err = sys_readdir(1, dirfd, dent, sizeof(buff), len);
-        if (err < 0) {
-            printf("readdir failed for: %s\n", dent->d_name);
-            if (max_err-- <= 0)
-                break;
-            
-            continue;
+        err = sys_readdirplus(1, dirfd, (struct my_direntplus *)buff,
+                              sizeof(buff),
+                              sizeof(buff) / sizeof(struct my_direntplus));
+        if (err < 0) {     /* nothing moved, so asking again won't help */
+            printf("readdirplus failed on: %s (%d)\n", dirname, err);
+            break;
         }
         
         if (err == 0)
             break;
 
+        for(i=0, dent=(struct my_direntplus *)buff; i < err; i++) {
+            st = &dent->d_stat;
 
-        err = sys_rstat(1, dirfd, dent->d_name, &st, 1);
-        if (err != 0) {
-            printf("stat failed for: %s (%ld)\n", dent->d_name, dent->d_ino);
-            if (max_err-- <= 0)
-                break;
-            
-            continue;
-        }
+            if (st->ino == 0) {         /* it couldn't be stat'ed */
+                printf("stat failed for: %s (%ld)\n", dent->d_ent.d_name,
+                       dent->d_ent.d_ino);
+                dent = (struct my_direntplus *)((char *)dent +
+                                                dent->d_ent.d_reclen);
+                continue;
+            }
 
-        tm = localtime(&st.mtime);
-        strftime(time_buf, sizeof(time_buf), "%b %d %I:%M", tm);
+            tm = localtime(&st->mtime);
+            strftime(time_buf, sizeof(time_buf), "%b %d %I:%M", tm);
 
-        mode_bits_to_str(st.mode, mode_str);
+            mode_bits_to_str(st->mode, mode_str);
 
-        printf("%12ld %s %6d %6d %12ld %s %s\n", st.ino, mode_str,
-               st.uid, st.gid, st.size, time_buf, dent->d_name);
-    }
+            printf("%12ld %s %6d %6d %12ld %s %s\n", st->ino, mode_str,
+                   st->uid, st->gid, st->size, time_buf, dent->d_ent.d_name);
 
-    if (err != 0) {
-        printf("readdir failed on: %s\n", dent->d_name);
+            dent = (struct my_direntplus *)((char *)dent +
+                                            dent->d_ent.d_reclen);
+        }
     }
 
     sys_closedir(1, dirfd);
@@ -405,6 +410,42 @@ do_trunc(int argc, char **argv)
 }
 
 
+static void
+do_falloc(int argc, char **argv)
+{
+    int             i, fd, err, mode = 0, size;
+    char            fname[256];
+
+    strcpy(fname, "/myfs/");
+    if (argc < 3) {
+        printf("usage: falloc fname size [keep] [unwritten]\n");
+        return;
+    }
+    strcat(fname, &argv[1][0]);
+    size = strtoul(&argv[2][0], NULL, 0);
+
+    for(i=3; i < argc; i++) {
+        if (strcmp(argv[i], "keep") == 0)
+            mode |= MY_FALLOC_KEEP_SIZE;
+        else if (strcmp(argv[i], "unwritten") == 0)
+            mode |= MY_FALLOC_UNWRITTEN;
+    }
+
+    fd = sys_open(1, -1, fname, O_RDWR, 0, 0);
+    if (fd < 0) {
+        printf("can't open %s (%s)\n", fname, strerror(fd));
+        return;
+    }
+
+    err = sys_fallocate(1, fd, mode, 0, size);
+    if (err != 0)
+        printf("falloc of %d bytes failed for %s (%s)\n", size, fname,
+               strerror(err));
+
+    sys_close(1, fd);
+}
+
+
 
 
 static void
@@ -715,10 +756,12 @@ mkfile(char *s, int sz)
 static void
 do_lat_fs(int argc, char **argv)
 {
-    int  i, j, iter;
-/*  int  sizes[] = { 0, 1024, 4096, 10*1024 }; */
-    int  sizes[] = { 0, 1024 };
-    char name[64];
+    int             i, j, iter;
+/*  int             sizes[] = { 0, 1024, 4096, 10*1024 }; */
+    int             sizes[] = { 0, 1024 };
+    char            name[64];
+    long            usecs;
+    struct timeval  start, end, result;
 
     iter = LAT_FS_ITER;
 
@@ -727,17 +770,29 @@ do_lat_fs(int argc, char **argv)
 
     for (i = 0; i < sizeof(sizes)/sizeof(int); ++i) {
         printf("CREATING: %d files of %5d bytes each\n", iter, sizes[i]);
+        gettimeofday(&start, NULL);
         for (j = 0; j < iter; ++j) {
             sprintf(name, "/myfs/%.5d", j);
             mkfile(name, sizes[i]);
         }
+        gettimeofday(&end, NULL);
+        SubTime(&end, &start, &result);
+        usecs = result.tv_sec * 1000000 + result.tv_usec;
+        printf("lat_fs: %ld creates/sec\n",
+               usecs ? (long)((double)iter * 1000000 / usecs) : 0);
 
         printf("DELETING: %d files of %5d bytes each\n", iter, sizes[i]);
+        gettimeofday(&start, NULL);
         for (j = 0; j < iter; ++j) {
             sprintf(name, "/myfs/%.5d", j);
             if (sys_unlink(1, -1, name) != 0)
                 printf("lat_fs: failed to remove: %s\n", name);
         }
+        gettimeofday(&end, NULL);
+        SubTime(&end, &start, &result);
+        usecs = result.tv_sec * 1000000 + result.tv_usec;
+        printf("lat_fs: %ld deletes/sec\n",
+               usecs ? (long)((double)iter * 1000000 / usecs) : 0);
     }
 }
 
@@ -789,6 +844,610 @@ do_delete(int argc, char **argv)
 
 
 
+/*
+  write N files of a given size with one write each (so the file
+  system sees the whole size at once), then report the throughput,
+  how many extents the files ended up in and the allocator calls it
+  took.  the files are removed afterwards so it can be run again.
+*/
+static void
+do_bigwrite(int argc, char **argv)
+{
+    int             i, fd, iter = 100, size = 128*1024, extents;
+    int             nfiles = 0, nextents = 0, errs = 0;
+    long            calls, usecs;
+    char           *buf, name[64];
+    struct timeval  start, end, result;
+
+    if (argc > 1)
+        iter = strtoul(&argv[1][0], NULL, 0);
+    if (argc > 2)
+        size = strtoul(&argv[2][0], NULL, 0);
+
+    sys_mkdir(1, -1, "/myfs/big", MY_S_IRWXU);  /* ok if it's there */
+
+    buf = (char *)malloc(size);
+    if (buf == NULL) {
+        printf("bigwrite: no memory for %d bytes\n", size);
+        return;
+    }
+
+    for(i=0; i < size; i++)
+        buf[i] = i;
+
+    calls = the_fs->bbm.alloc_calls;
+
+    gettimeofday(&start, NULL);
+    for(i=0; i < iter; i++) {
+        sprintf(name, "/myfs/big/%.5d", i);
+        fd = sys_open(1, -1, name, O_RDWR|O_CREAT,
+                      MY_S_IFREG|MY_S_IRWXU, 0);
+        if (fd < 0) {
+            errs++;
+            continue;
+        }
+
+        if (sys_write(1, fd, buf, size) != size)
+            errs++;
+
+        sys_close(1, fd);
+    }
+    sys_sync();
+    gettimeofday(&end, NULL);
+    SubTime(&end, &start, &result);
+
+    calls = the_fs->bbm.alloc_calls - calls;
+
+    for(i=0; i < iter; i++) {
+        sprintf(name, "/myfs/big/%.5d", i);
+        fd = sys_open(1, -1, name, O_RDONLY, 0, 0);
+        if (fd < 0)
+            continue;
+
+        if (sys_ioctl(1, fd, MYFS_IOCTL_COUNT_EXTENTS, &extents,
+                      sizeof(extents)) == 0) {
+            nfiles++;
+            nextents += extents;
+        }
+        sys_close(1, fd);
+        sys_unlink(1, -1, name);
+    }
+
+    usecs = result.tv_sec * 1000000 + result.tv_usec;
+    printf("bigwrite: %d files of %d bytes in %2ld.%.6ld seconds (%ld KB/s), "
+           "%d errors\n", iter, size, result.tv_sec, result.tv_usec,
+           usecs ? (long)((double)iter * size / 1024 * 1000000 / usecs) : 0,
+           errs);
+    if (nfiles)
+        printf("bigwrite: %ld allocator calls, %d.%.2d extents per file\n",
+               calls, nextents / nfiles, (nextents * 100 / nfiles) % 100);
+
+    free(buf);
+}
+
+
+#define MAX_LOGS  64
+
+/*
+  grow N files at once, a chunk at a time and round robin, the way a
+  bunch of log files get written.  reports how many extents the files
+  end up in.  with "prealloc" each file gets all its space up front
+  with sys_fallocate().
+*/
+static void
+do_logs(int argc, char **argv)
+{
+    int   i, j, nfiles = 16, size = 64*1024, chunk = 512, extents;
+    int   fds[MAX_LOGS], nextents = 0, counted = 0, errs = 0, prealloc = 0;
+    long  calls;
+    char *buf, name[64];
+
+    if (argc > 1)
+        nfiles = strtoul(&argv[1][0], NULL, 0);
+    if (argc > 2)
+        size = strtoul(&argv[2][0], NULL, 0);
+    if (argc > 3)
+        chunk = strtoul(&argv[3][0], NULL, 0);
+    if (argc > 4)
+        prealloc = (strcmp(argv[4], "prealloc") == 0);
+
+    if (nfiles <= 0 || nfiles > MAX_LOGS || chunk <= 0) {
+        printf("usage: logs [files (max %d)] [size] [chunk] [prealloc]\n",
+               MAX_LOGS);
+        return;
+    }
+
+    buf = (char *)malloc(chunk);
+    if (buf == NULL) {
+        printf("logs: no memory for %d bytes\n", chunk);
+        return;
+    }
+    memset(buf, 'l', chunk);
+
+    sys_mkdir(1, -1, "/myfs/logs", MY_S_IRWXU);  /* ok if it's there */
+
+    for(i=0; i < nfiles; i++) {
+        sprintf(name, "/myfs/logs/%.5d", i);
+        fds[i] = sys_open(1, -1, name, O_RDWR|O_CREAT,
+                          MY_S_IFREG|MY_S_IRWXU, 0);
+        if (fds[i] < 0)
+            errs++;
+        else if (prealloc && sys_fallocate(1, fds[i], MY_FALLOC_KEEP_SIZE |
+                                           MY_FALLOC_UNWRITTEN, 0, size) != 0)
+            errs++;
+    }
+
+    calls = the_fs->bbm.alloc_calls;
+
+    for(j=0; j < size; j += chunk) {
+        for(i=0; i < nfiles; i++) {
+            if (fds[i] >= 0 && sys_write(1, fds[i], buf, chunk) != chunk)
+                errs++;
+        }
+    }
+
+    calls = the_fs->bbm.alloc_calls - calls;
+
+    for(i=0; i < nfiles; i++) {
+        if (fds[i] < 0)
+            continue;
+
+        if (sys_ioctl(1, fds[i], MYFS_IOCTL_COUNT_EXTENTS, &extents,
+                      sizeof(extents)) == 0) {
+            counted++;
+            nextents += extents;
+        }
+        sys_close(1, fds[i]);
+
+        sprintf(name, "/myfs/logs/%.5d", i);
+        sys_unlink(1, -1, name);
+    }
+
+    if (counted)
+        printf("logs: %d files of %d bytes in %d byte writes: %d.%.2d "
+               "extents per file, %ld allocator calls writing, %d errors\n",
+               nfiles, size, chunk, nextents / counted,
+               (nextents * 100 / counted) % 100, calls, errs);
+
+    free(buf);
+}
+
+
+#define LSB_MAX_DIRS   64
+#define LSB_MAX_FILES  4096
+
+static int
+compare_long(const void *a, const void *b)
+{
+    long la = *(const long *)a, lb = *(const long *)b;
+
+    return (la < lb) ? -1 : (la > lb);
+}
+
+/*
+  age a tree and time "ls -l" on it.  files are created in all the
+  directories round robin, and every other one is deleted after each
+  round but the last, the way a tree that's been in use for a while
+  looks.  then every directory is listed with readdirplus.  how many
+  inode table blocks a directory's inodes are spread over is what a
+  cold listing has to read.
+*/
+static void
+do_lsbench(int argc, char **argv)
+{
+    int             i, j, r, d, n, err, ndirs = 16, nfiles = 64, rounds = 3;
+    int             iter = 10, bsize = the_fs->dsb.block_size, dirfd;
+    long            nblocks = 0, maxblocks = 0, nents = 0, last, usecs;
+    long long       buff[1024];
+    char            name[64];
+    struct my_direntplus *dent;
+    struct timeval  start, end, result;
+    static long     blocks[LSB_MAX_FILES];
+
+    if (argc > 1)
+        ndirs = strtoul(&argv[1][0], NULL, 0);
+    if (argc > 2)
+        nfiles = strtoul(&argv[2][0], NULL, 0);
+    if (argc > 3)
+        rounds = strtoul(&argv[3][0], NULL, 0);
+
+    if (ndirs <= 0 || ndirs > LSB_MAX_DIRS || nfiles <= 0 || rounds <= 0 ||
+        nfiles * rounds > LSB_MAX_FILES) {
+        printf("usage: lsbench [dirs (max %d)] [files] [rounds]\n",
+               LSB_MAX_DIRS);
+        return;
+    }
+
+    sys_mkdir(1, -1, "/myfs/ls", MY_S_IRWXU);
+    for(d=0; d < ndirs; d++) {
+        sprintf(name, "/myfs/ls/d%.2d", d);
+        sys_mkdir(1, -1, name, MY_S_IRWXU);
+    }
+
+    for(r=0; r < rounds; r++) {
+        for(j=0; j < nfiles; j++) {
+            for(d=0; d < ndirs; d++) {
+                sprintf(name, "/myfs/ls/d%.2d/%d.%.5d", d, r, j);
+                mkfile(name, 1024);
+            }
+        }
+
+        if (r == rounds - 1)
+            break;
+
+        for(j=1; j < nfiles; j += 2) {
+            for(d=0; d < ndirs; d++) {
+                sprintf(name, "/myfs/ls/d%.2d/%d.%.5d", d, r, j);
+                sys_unlink(1, -1, name);
+            }
+        }
+    }
+
+    gettimeofday(&start, NULL);
+    for(i=0; i < iter; i++) {
+        for(d=0; d < ndirs; d++) {
+            sprintf(name, "/myfs/ls/d%.2d", d);
+            if ((dirfd = sys_opendir(1, -1, name, 0)) < 0)
+                continue;
+
+            n = 0;
+            while((err = sys_readdirplus(1, dirfd,
+                                         (struct my_direntplus *)buff,
+                                         sizeof(buff),
+                                         sizeof(buff) /
+                                         sizeof(struct my_direntplus))) > 0) {
+                dent = (struct my_direntplus *)buff;
+                for(j=0; j < err; j++) {
+                    if (i == 0 && n < LSB_MAX_FILES &&
+                        MY_S_ISREG(dent->d_stat.mode))
+                        blocks[n++] = (dent->d_stat.ino * INODE_SIZE(the_fs)) /
+                                      bsize;
+                    dent = (struct my_direntplus *)((char *)dent +
+                                                    dent->d_ent.d_reclen);
+                }
+            }
+            if (err < 0)
+                printf("lsbench: readdirplus failed on: %s (%d)\n", name, err);
+            sys_closedir(1, dirfd);
+
+            if (i != 0)
+                continue;
+
+            /* count the distinct inode table blocks */
+            qsort(blocks, n, sizeof(long), compare_long);
+            for(j=0, r=0, last=-1; j < n; j++) {
+                if (blocks[j] != last)
+                    r++;
+                last = blocks[j];
+            }
+            nblocks += r;
+            nents   += n;
+            if (r > maxblocks)
+                maxblocks = r;
+        }
+    }
+    gettimeofday(&end, NULL);
+    SubTime(&end, &start, &result);
+    usecs = result.tv_sec * 1000000 + result.tv_usec;
+
+    printf("lsbench: %d dirs of %ld files: %ld.%.2ld inode table blocks per "
+           "dir (most %ld, least possible %ld)\n", ndirs, nents / ndirs,
+           nblocks / ndirs, (nblocks * 100 / ndirs) % 100, maxblocks,
+           (nents / ndirs * INODE_SIZE(the_fs) + bsize - 1) / bsize);
+    printf("lsbench: %ld usec per ls -l\n", usecs / (iter * ndirs));
+}
+
+
+/*
+  report how fragmented the files and the free space are and rewrite
+  the fragmented files into single runs (unless -n is given).
+*/
+static void
+do_defrag(int argc, char **argv)
+{
+    int         i, flags = FRAG_MOVE;
+    char        dirname[256];
+    frag_stats  st;
+
+    strcpy(dirname, "/myfs");
+    for(i=1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0)
+            flags &= ~FRAG_MOVE;
+        else if (strcmp(argv[i], "-v") == 0)
+            flags |= FRAG_VERBOSE;
+        else
+            sprintf(dirname, "/myfs/%s", argv[i]);
+    }
+
+    myfs_release_all_windows(the_fs);
+
+    memset(&st, 0, sizeof(st));
+    frag_walk(dirname, flags, &st);
+    frag_print_stats(&st);
+    frag_print_free_space(the_fs);
+}
+
+
+/* print the counters the file system keeps on itself */
+static void
+do_stats(int argc, char **argv)
+{
+    myfs_info *myfs = the_fs;
+
+    printf("%s allocator: %ld allocs, %ld frees in %ld.%.6ld seconds\n",
+           (myfs->dsb.features & MYFS_FEATURE_EXTENT_ALLOC) ? "extent" : "bitmap",
+           myfs->bbm.alloc_calls, myfs->bbm.free_calls,
+           (long)(myfs->bbm.alloc_time / 1000000),
+           (long)(myfs->bbm.alloc_time % 1000000));
+
+    printf("inodes: %ld loads, %ld from the free list, %ld slabs, %ld of "
+           "an inode just released\n", myfs->icache.gets, myfs->icache.reuses,
+           myfs->icache.slabs_made, myfs->icache.recent_hits);
+    printf("inode table: %ld inodes loaded in batches, %ld prefetch reads\n",
+           myfs->icache.batched, myfs->icache.prefetches);
+
+    printf("super block: %ld writes\n", myfs->sb_writes);
+    printf("inode writes: %ld to the inode table for %ld changes\n",
+           myfs->inode_writes, myfs->inode_deferred);
+
+    if (myfs->dsb.features & MYFS_FEATURE_INLINE_DATA)
+        printf("inline data: %d bytes per inode, %ld files outgrew it\n",
+               (int)INLINE_SIZE(myfs), myfs->inline_moved);
+
+    printf("block map cache: %ld hits, %ld misses\n", myfs->map_hits,
+           myfs->map_misses);
+    printf("data reads: %ld runs of %ld blocks into the caller's buffer\n",
+           myfs->read_runs, myfs->read_run_blocks);
+    printf("data writes: %ld runs of %ld blocks from the caller's buffer\n",
+           myfs->write_runs, myfs->write_run_blocks);
+
+    if (EXTENT_MAPPED(myfs))
+        printf("extent map: %ld tree blocks made\n", myfs->extent_nodes);
+
+    if (myfs->dsb.features & MYFS_FEATURE_DELALLOC)
+        printf("delalloc: %ld flushes, %ld blocks allocated, %ld blocks "
+               "never allocated\n", myfs->da_flushes, (long)myfs->da_flushed,
+               (long)myfs->da_dropped);
+}
+
+
+/* show the reservation windows of the files being written */
+static void
+do_rsv(int argc, char **argv)
+{
+    int         n = 0;
+    rsv_window *w;
+
+    printf("  inode    next block  left   size    hits\n");
+    for(w=the_fs->bbm.windows; w; w=w->next, n++) {
+        printf("%7ld  %12ld  %4ld  %5ld  %6ld\n", (long)w->mi->inode_num,
+               (long)w->start, (long)w->len, (long)w->size, w->hits);
+    }
+
+    printf("%d windows, %ld blocks held.  %ld fills, %ld allocations from "
+           "windows, %ld blocks returned unused\n", n,
+           (long)the_fs->bbm.rsv_blocks, the_fs->bbm.rsv_fills,
+           the_fs->bbm.rsv_hits, (long)the_fs->bbm.rsv_returned);
+}
+
+
+#define RING_ENTRIES  64
+
+/*
+  push N small files through an io ring: create -> write -> close
+  chains to make them, open -> read -> close chains to read them back
+  and then batches of unlinks.  each pass reports how long it took and
+  the ring statistics are printed at the end.
+*/
+static void
+do_ring(int argc, char **argv)
+{
+    int             i, j, k, n, iter = 100, size = 1024, pass, batch, errs = 0;
+    char            names[RING_ENTRIES][32], *wbuf, *rbuf;
+    io_ring        *ring;
+    io_sqe         *sqe;
+    io_cqe          cqes[2*RING_ENTRIES];
+    io_ring_stats   st;
+    struct timeval  start, end, result;
+    static char    *pass_names[] = { "create", "read", "unlink" };
+
+    if (argc > 1)
+        iter = strtoul(&argv[1][0], NULL, 0);
+    if (argc > 2)
+        size = strtoul(&argv[2][0], NULL, 0);
+
+    sys_mkdir(1, -1, "/myfs/ring", MY_S_IRWXU);  /* ok if it's there */
+
+    wbuf = (char *)malloc(size + 1);
+    rbuf = (char *)malloc((RING_ENTRIES / 3) * (size + 1));
+    ring = sys_io_ring_create(1, RING_ENTRIES);
+    if (wbuf == NULL || rbuf == NULL || ring == NULL) {
+        printf("ring: out of memory\n");
+        goto done;
+    }
+
+    for(i=0; i < size; i++)
+        wbuf[i] = 'a' + (i % 26);
+
+    for(pass=0; pass < 3; pass++) {
+        batch = (pass == 2) ? RING_ENTRIES : RING_ENTRIES / 3;
+
+        gettimeofday(&start, NULL);
+        for(i=0; i < iter; i += batch) {
+            for(j=0; j < batch && i + j < iter; j++) {
+                sprintf(names[j], "/myfs/ring/%.5d", i + j);
+
+                sqe = sys_io_get_sqe(ring);
+                sqe->path = names[j];
+                sqe->user_data = (void *)(long)IORING_OP_UNLINK;
+                if (pass == 2) {
+                    sqe->op = IORING_OP_UNLINK;
+                    continue;
+                }
+
+                sqe->flags = IOSQE_LINK;
+                sqe->perms = MY_S_IFREG | MY_S_IRWXU;
+                if (pass == 0) {
+                    sqe->op    = IORING_OP_CREATE;
+                    sqe->omode = O_RDWR;
+                } else {
+                    sqe->op    = IORING_OP_OPEN;
+                    sqe->omode = O_RDONLY;
+                }
+                sqe->user_data = (void *)(long)sqe->op;
+
+                sqe = sys_io_get_sqe(ring);
+                sqe->op    = (pass == 0) ? IORING_OP_WRITE : IORING_OP_READ;
+                sqe->flags = IOSQE_LINK | IOSQE_LINK_FD;
+                sqe->buf   = (pass == 0) ? wbuf : &rbuf[j * (size + 1)];
+                sqe->len   = size;
+                sqe->user_data = (void *)(long)sqe->op;
+
+                sqe = sys_io_get_sqe(ring);
+                sqe->op    = IORING_OP_CLOSE;
+                sqe->flags = IOSQE_LINK_FD;
+                sqe->user_data = (void *)(long)sqe->op;
+            }
+
+            sys_io_submit(ring);
+
+            k = 0;
+            while((n = sys_io_reap(ring, cqes, sizeof(cqes)/sizeof(io_cqe))) > 0) {
+                for(j=0; j < n; j++) {
+                    if (cqes[j].res < 0)
+                        errs++;
+                    else if ((long)cqes[j].user_data == IORING_OP_READ) {
+                        if (cqes[j].res != size ||
+                            memcmp(&rbuf[k * (size + 1)], wbuf, size) != 0)
+                            errs++;
+                        k++;
+                    }
+                }
+            }
+        }
+        gettimeofday(&end, NULL);
+        SubTime(&end, &start, &result);
+
+        printf("%-6s: %d files of %d bytes in %2ld.%.6ld seconds\n",
+               pass_names[pass], iter, size, result.tv_sec, result.tv_usec);
+    }
+
+    sys_io_ring_stats(ring, &st);
+    printf("ring: %ld submitted, %ld completed, %ld failed, %ld canceled, "
+           "%d errors\n", st.submitted, st.completed, st.failed, st.canceled,
+           errs);
+    printf("ring: %ld submit calls, at most %ld queued, %ld.%.6ld seconds "
+           "busy\n", st.submit_calls, st.max_queued,
+           (long)(st.busy_time / 1000000), (long)(st.busy_time % 1000000));
+
+done:
+    if (ring)
+        sys_io_ring_destroy(ring);
+    free(rbuf);
+    free(wbuf);
+}
+
+
+/*
+  fill a bit vector with one of a few synthetic fragmentation patterns
+  for the bit vector benchmark below.
+*/
+static void
+fill_bv_pattern(BitVector *bv, int pattern, int len)
+{
+    int i, n;
+
+    memset(bv->bits, 0, (bv->numbits + 7) / 8);
+    bv->next_free = 0;
+    bv->is_full   = 0;
+
+    switch (pattern) {
+    case 0:     /* every other bit used */
+        for(i=0; i < bv->numbits; i += 2)
+            SetBV(bv, i);
+        break;
+
+    case 1:     /* random short runs of used and free bits */
+        for(i=0; i < bv->numbits; ) {
+            for(n = 1 + rand() % 8; n > 0 && i < bv->numbits; n--)
+                SetBV(bv, i++);
+            i += 1 + rand() % 8;
+        }
+        break;
+
+    case 2:     /* long used runs with free holes just too small to use */
+        for(i=0; i < bv->numbits; ) {
+            for(n = 1 + rand() % 512; n > 0 && i < bv->numbits; n--)
+                SetBV(bv, i++);
+            i += 1 + rand() % (len - 1 > 0 ? len - 1 : 1);
+        }
+        break;
+
+    case 3:     /* full except for a few holes that are just too small */
+        for(i=0; i < bv->numbits; i++)
+            if ((i % 4096) >= len - 1)
+                SetBV(bv, i);
+        break;
+    }
+}
+
+
+static void
+do_bvbench(int argc, char **argv)
+{
+    int             i, pattern, iter = 1000, len = 16, nbits = 4*1024*1024;
+    int             got, failed, before, after;
+    BitVector       bv;
+    struct timeval  start, end, result;
+    static char    *pattern_names[] = {
+        "alternate", "short runs", "long runs", "nearly full"
+    };
+
+    if (argc > 1)
+        iter = strtoul(&argv[1][0], NULL, 0);
+    if (argc > 2)
+        len = strtoul(&argv[2][0], NULL, 0);
+    if (argc > 3)
+        nbits = strtoul(&argv[3][0], NULL, 0);
+
+    if (len <= 0 || nbits < len) {
+        printf("usage: bvbench [iter] [len] [nbits]\n");
+        return;
+    }
+
+    bv.numbits = nbits;
+    bv.bits    = (chunk *)calloc(1, (nbits + 63) / 64 * 8);
+    if (bv.bits == NULL) {
+        printf("bvbench: no memory for %d bits\n", nbits);
+        return;
+    }
+
+    for(pattern=0; pattern < 4; pattern++) {
+        srand(pattern);
+        fill_bv_pattern(&bv, pattern, len);
+        before = CountBitsBV(&bv);
+
+        gettimeofday(&start, NULL);
+        for(i=0, got=0, failed=0; i < iter; i++) {
+            if (GetFreeRangeOfBits(&bv, len, NULL) != -1)
+                got++;
+            else
+                failed++;
+        }
+        gettimeofday(&end, NULL);
+        SubTime(&end, &start, &result);
+
+        after = CountBitsBV(&bv);
+        printf("%-12s: %d allocs of %d bits (%d failed) in %2ld.%.6ld "
+               "seconds%s\n", pattern_names[pattern], iter, len, failed,
+               result.tv_sec, result.tv_usec,
+               (after - before != got * len) ? " *** bit count mismatch" : "");
+    }
+
+    free(bv.bits);
+}
+
+
 static void do_help(int argc, char **argv);
 
 
@@ -814,12 +1473,21 @@ cmd_entry fsh_cmds[] =
     { "cp",      do_copy, "copy a file to/from myfs. prefix a ':' for host filenames" },
     { "copy",    do_copy, "same as cp" },
     { "trunc",   do_trunc, "truncate a file to the size specified" },
+    { "falloc",  do_falloc, "preallocate space for a file [keep] [unwritten]" },
     { "seek",    do_seek, "seek to the position specified" },
     { "mv",      do_rename, "rename a file or directory" },
     { "sync",    do_sync, "call sync" },
     { "lat_fs",  do_lat_fs, "simulate what the lmbench test lat_fs does" },
     { "create",  do_create, "create N files. default is 100" },
     { "delete",  do_delete, "delete N files. default is 100" },
+    { "bigwrite", do_bigwrite, "time writing N files of a given size in one write each" },
+    { "logs",    do_logs, "grow N files at once, round robin, and count extents" },
+    { "rsv",     do_rsv, "show the block reservation windows of open files" },
+    { "stats",   do_stats, "print the file system's allocation and i/o counters" },
+    { "lsbench", do_lsbench, "age a tree of N dirs and time ls -l on them" },
+    { "defrag",  do_defrag, "report fragmentation and defragment files [-n] [-v] [dir]" },
+    { "ring",    do_ring, "create, read and delete N files through an io ring" },
+    { "bvbench", do_bvbench, "time bit vector range allocation on fragmented maps" },
     { "help",    do_help, "print this help message" },
     { "?",       do_help, "print this help message" },
     { NULL, NULL }
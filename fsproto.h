@@ -32,6 +32,8 @@ struct fsinfo;
 typedef int op_read_vnode(void *ns, vnode_id vnid, char r, void **node);
 typedef int op_release_vnode(void *ns, void *node, char r);
 typedef int op_remove_vnode(void *ns, void *node, char r);
+typedef int op_read_vnodes(void *ns, vnode_id *vnids, int n, char r,
+                    void **nodes);
 
 typedef int op_walk(void *ns, void *base, const char *file, char **newpath,
                     vnode_id *vnid);
@@ -57,6 +59,8 @@ typedef int op_closedir(void *ns, void *node, void *cookie);
 typedef int op_rewinddir(void *ns, void *node, void *cookie);
 typedef int op_readdir(void *ns, void *node, void *cookie, long *num,
                     struct my_dirent *buf, size_t bufsize);
+typedef int op_readdirplus(void *ns, void *node, void *cookie, long *num,
+                    struct my_direntplus *buf, size_t bufsize);
 
 typedef int op_open(void *ns, void *node, int omode, void **cookie);
 typedef int op_close(void *ns, void *node, void *cookie);
@@ -65,8 +69,14 @@ typedef int op_read(void *ns, void *node, void *cookie, fs_off_t pos, void *buf,
                     size_t *len);
 typedef int op_write(void *ns, void *node, void *cookie, fs_off_t pos,
                     const void *buf, size_t *len);
+typedef int op_readv(void *ns, void *node, void *cookie, fs_off_t pos,
+                    const struct iovec *vec, size_t count, size_t *len);
+typedef int op_writev(void *ns, void *node, void *cookie, fs_off_t pos,
+                    const struct iovec *vec, size_t count, size_t *len);
 typedef int op_ioctl(void *ns, void *node, void *cookie, int cmd, void *buf,
                     size_t len);
+typedef int op_fallocate(void *ns, void *node, void *cookie, int mode,
+                    fs_off_t pos, fs_off_t len);
 
 typedef int op_rstat(void *ns, void *node, struct my_stat *);
 typedef int op_wstat(void *ns, void *node, struct my_stat *, long mask);
@@ -108,6 +118,11 @@ typedef struct vnode_ops {
     op_mount                (*mount);
     op_unmount              (*unmount);
     op_sync                 (*sync);
+    op_readv                (*readv);
+    op_writev               (*writev);
+    op_readdirplus          (*readdirplus);
+    op_fallocate            (*fallocate);
+    op_read_vnodes          (*read_vnodes);
 } vnode_ops;
 
 extern int      new_path(const char *path, char **copy);
@@ -116,6 +131,8 @@ extern void     free_path(char *p);
 extern int      notify_listener(int op, nspace_id nsid, vnode_id vnida,
                                 vnode_id vnidb, vnode_id vnidc, const char *name);
 extern int      get_vnode(nspace_id nsid, vnode_id vnid, void **data);
+extern int      get_vnodes(nspace_id nsid, vnode_id *vnids, int n,
+                           void **data);
 extern int      put_vnode(nspace_id nsid, vnode_id vnid);
 extern int      new_vnode(nspace_id nsid, vnode_id vnid, void *data);
 extern int      remove_vnode(nspace_id nsid, vnode_id vnid);
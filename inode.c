@@ -12,6 +12,316 @@
 */
 #include "myfs.h"
 
+static void unlink_dirty_inode(myfs_info *myfs, myfs_inode *mi);
+
+
+/*
+  the in-memory inode cache.  an inode_obj is the inode and its etc in
+  one piece; the lock in the etc is made when the slab is and lives as
+  long as it does, so it must be unlocked whenever the object is put
+  back.  objects are never freed until the volume is unmounted, by which
+  time every vnode has been released.  on a volume with inline data the
+  room for it follows each object, so they're ic->obj_size bytes apart.
+*/
+typedef struct inode_obj {
+    myfs_inode        inode;          /* must be first */
+    myfs_inode_etc    etc;
+    struct inode_obj *next;           /* on the free list */
+} inode_obj;
+
+typedef struct inode_slab {
+    struct inode_slab *next;          /* the objects come right after */
+} inode_slab;
+
+#define SLAB_OBJ(ic, slab, i) \
+    ((inode_obj *)((char *)((slab) + 1) + (i) * (ic)->obj_size))
+
+
+static int
+init_inode_cache(myfs_info *myfs)
+{
+    inode_cache *ic = &myfs->icache;
+    int          i;
+
+    memset(ic, 0, sizeof(*ic));
+    for(i=0; i < INODE_RECENT; i++)
+        ic->recent[i] = -1;
+    ic->last_block = -1;
+
+    ic->obj_size = (sizeof(inode_obj) + INLINE_SIZE(myfs) + 7) & ~7;
+
+    ic->sem = create_sem(1, "myfs inode cache");
+    if (ic->sem < 0)
+        return ENOMEM;
+
+    return 0;
+}
+
+
+static void
+shutdown_inode_cache(myfs_info *myfs)
+{
+    inode_cache *ic = &myfs->icache;
+    inode_slab  *slab, *next;
+    int          i;
+
+    for(slab=ic->slabs; slab; slab=next) {
+        next = slab->next;
+        for(i=0; i < INODE_SLAB_COUNT; i++)
+            free_lock(&SLAB_OBJ(ic, slab, i)->etc.lock);
+        free(slab);
+    }
+
+    if (ic->sem > 0)
+        delete_sem(ic->sem);
+
+    memset(ic, 0, sizeof(*ic));
+}
+
+
+static int
+grow_inode_cache(inode_cache *ic)
+{
+    inode_slab *slab;
+    inode_obj  *obj;
+    int         i;
+
+    slab = (inode_slab *)calloc(1, sizeof(inode_slab) +
+                                   INODE_SLAB_COUNT * ic->obj_size);
+    if (slab == NULL)
+        return ENOMEM;
+
+    for(i=0; i < INODE_SLAB_COUNT; i++) {
+        if (new_lock(&SLAB_OBJ(ic, slab, i)->etc.lock, "myfs inode") != 0)
+            goto err;
+    }
+
+    for(i=INODE_SLAB_COUNT-1; i >= 0; i--) {
+        obj = SLAB_OBJ(ic, slab, i);
+        obj->next = ic->free;
+        ic->free  = obj;
+    }
+
+    slab->next = ic->slabs;
+    ic->slabs  = slab;
+    ic->slabs_made++;
+
+    return 0;
+
+ err:
+    while(--i >= 0)
+        free_lock(&SLAB_OBJ(ic, slab, i)->etc.lock);
+    free(slab);
+
+    return ENOMEM;
+}
+
+
+/*
+  get a zeroed in-memory inode with its etc attached and its lock
+  ready.  ia is the inode about to be loaded into it, or -1 for a new
+  one; it's only used to notice that it was released a moment ago.
+*/
+myfs_inode *
+myfs_get_inode(myfs_info *myfs, inode_addr ia)
+{
+    inode_cache *ic = &myfs->icache;
+    inode_obj   *obj;
+    lock         l;
+
+    acquire_sem(ic->sem);
+
+    ic->gets++;
+    if (ia >= 0 && ic->recent[ia % INODE_RECENT] == ia) {
+        ic->recent_hits++;
+        ic->recent[ia % INODE_RECENT] = -1;
+    }
+
+    if (ic->free == NULL) {
+        if (grow_inode_cache(ic) != 0) {
+            release_sem(ic->sem);
+            return NULL;
+        }
+    } else {
+        ic->reuses++;
+    }
+
+    obj = ic->free;
+    ic->free = obj->next;
+
+    release_sem(ic->sem);
+
+    l = obj->etc.lock;
+    memset(obj, 0, ic->obj_size);
+    obj->etc.lock  = l;
+    obj->inode.etc = &obj->etc;
+    if (ic->obj_size > sizeof(inode_obj))
+        obj->etc.inline_data = (char *)(obj + 1);
+
+    return &obj->inode;
+}
+
+
+/* give back an inode from myfs_get_inode() along with its directory data */
+void
+myfs_put_inode(myfs_info *myfs, myfs_inode *mi)
+{
+    inode_cache *ic  = &myfs->icache;
+    inode_obj   *obj = (inode_obj *)mi;
+
+    if (mi->etc != &obj->etc)
+        myfs_die("inode @ 0x%lx: not from the inode cache\n", (ulong)mi);
+
+    if (mi->etc->contents) {
+        free(mi->etc->contents);
+        mi->etc->contents = NULL;
+    }
+
+    /* anything that mattered was written in release_vnode() */
+    if (mi->etc->dirty)
+        unlink_dirty_inode(myfs, mi);
+
+    mi->magic1 = 0;               /* so a stale pointer trips CHECK_INODE */
+
+    acquire_sem(ic->sem);
+
+    if (mi->inode_num > 0)
+        ic->recent[mi->inode_num % INODE_RECENT] = mi->inode_num;
+
+    obj->next = ic->free;
+    ic->free  = obj;
+
+    release_sem(ic->sem);
+}
+
+
+/*
+  inode table prefetch.  three loads in a row from consecutive table
+  blocks (readdir+stat, a path walk down a new tree, check) look like a
+  scan, so the next INODE_PREFETCH blocks are pulled into the cache in
+  a few big reads.  the fields are only hints so they aren't locked.
+*/
+static void
+prefetch_inode_table(myfs_info *myfs, fs_off_t start, fs_off_t end)
+{
+    inode_cache *ic = &myfs->icache;
+    fs_off_t     table_end;
+
+    table_end = myfs->dsb.inodes_start + myfs->dsb.num_inode_blocks;
+    if (end > table_end)
+        end = table_end;
+    if (start < ic->ra_end && end > ic->ra_end)
+        start = ic->ra_end;           /* the first part was done already */
+
+    if (start < end)
+        ic->prefetches += prefetch_blocks(myfs->fd, start, end - start,
+                                          myfs->dsb.block_size);
+    if (end > ic->ra_end)
+        ic->ra_end = end;
+}
+
+
+static void
+note_inode_load(myfs_info *myfs, fs_off_t addr)
+{
+    inode_cache *ic = &myfs->icache;
+
+    if (addr == ic->last_block)
+        return;
+
+    if (addr == ic->last_block + 1) {
+        ic->seq++;
+    } else {
+        ic->seq    = 0;              /* a new scan starts from scratch */
+        ic->ra_end = 0;
+    }
+    ic->last_block = addr;
+
+    if (ic->seq >= 2 && addr + INODE_PREFETCH / 2 >= ic->ra_end)
+        prefetch_inode_table(myfs, addr + 1, addr + 1 + INODE_PREFETCH);
+}
+
+
+/*
+  read inodes ia[0..n-1] into in-memory inodes from the cache.  all the
+  ones that share an inode table block are decoded while it's held, so
+  a sorted list costs one get_block() per block.  a batch that spans
+  less than INODE_PREFETCH blocks is prefetched as a whole first.  on
+  error nothing is returned.
+*/
+int
+myfs_load_inodes(myfs_info *myfs, inode_addr *ia, int n, myfs_inode **mis)
+{
+    int             i, bsize = myfs->dsb.block_size, err = 0;
+    int             per_block = bsize / INODE_SIZE(myfs), offset;
+    char           *block = NULL;
+    fs_off_t        addr, cur = -1, first, last;
+    myfs_inode_etc *metc;
+
+    if (n <= 0)
+        return EINVAL;
+
+    first = myfs->dsb.inodes_start + ia[0] / per_block;
+    last  = myfs->dsb.inodes_start + ia[n-1] / per_block;
+    if (n > 1 && first < last && last - first < INODE_PREFETCH)
+        prefetch_inode_table(myfs, first, last + 1);
+    else
+        note_inode_load(myfs, first);
+
+    for(i=0; i < n; i++) {
+        if (ia[i] <= 0 || ia[i] >= myfs->dsb.num_inodes) {
+            printf("bogus inode number %ld\n", (long)ia[i]);
+            err = EINVAL;
+            break;
+        }
+
+        addr   = myfs->dsb.inodes_start + ia[i] / per_block;
+        offset = (ia[i] % per_block) * INODE_SIZE(myfs);
+
+        if (addr != cur) {
+            if (block)
+                release_block(myfs->fd, cur);
+
+            block = get_block(myfs->fd, addr, bsize);
+            if (block == NULL) {
+                printf("couldn't read inode block at block #%ld", addr);
+                err = EINVAL;
+                break;
+            }
+            cur = addr;
+        }
+
+        mis[i] = myfs_get_inode(myfs, ia[i]);
+        if (mis[i] == NULL) {
+            err = ENOMEM;
+            break;
+        }
+
+        metc = mis[i]->etc;
+        memcpy(mis[i], &block[offset], sizeof(myfs_inode));
+        mis[i]->etc = metc;
+
+        if (metc->inline_data)
+            memcpy(metc->inline_data, &block[offset + sizeof(myfs_inode)],
+                   INLINE_SIZE(myfs));
+
+        CHECK_INODE(mis[i]);    /* make sure it's not corrupt */
+    }
+
+    if (block)
+        release_block(myfs->fd, cur);
+
+    if (err) {
+        while(--i >= 0)
+            myfs_put_inode(myfs, mis[i]);
+    } else if (n > 1) {
+        myfs->icache.batched += n;
+    }
+
+    return err;
+}
+
+
 int
 myfs_create_inodes(myfs_info *myfs)
 {
@@ -26,7 +336,7 @@ myfs_create_inodes(myfs_info *myfs)
 
     /* we allocate 1 inode for every 4 disk blocks */
     num_inodes       = (myfs->dsb.num_blocks >> 2);
-    num_inode_blocks = (num_inodes * sizeof(myfs_inode)) / bsize;
+    num_inode_blocks = (num_inodes * INODE_SIZE(myfs)) / bsize;
     num_map_blocks   = (num_inode_blocks / 8 / bsize) + 1;
 
     printf("num inodes %ld num_map_blocks %ld num_inode blocks %ld\n",
@@ -80,7 +390,8 @@ myfs_create_inodes(myfs_info *myfs)
 
     myfs->inode_map.bits    = calloc(1, num_map_blocks * bsize);
     myfs->inode_map.numbits = num_inodes;
-    if (myfs->inode_map.bits == NULL) {
+    myfs->inode_map_dirty   = calloc(1, num_map_blocks);
+    if (myfs->inode_map.bits == NULL || myfs->inode_map_dirty == NULL) {
         printf("couldn't allocate space for the in memory inode map\n");
         return ENOMEM;
     }
@@ -89,7 +400,35 @@ myfs_create_inodes(myfs_info *myfs)
     GetFreeRangeOfBits(&myfs->inode_map, 1, NULL);
     write_blocks(myfs, map_start, myfs->inode_map.bits, 1);
 
-    return 0;
+    myfs_count_group_inodes(myfs);
+
+    return init_inode_cache(myfs);
+}
+
+
+/*
+  split the inodes among the allocation groups (a multiple of 64 each
+  so the bit vector summaries work) and count the free ones in each.
+  this needs both the inode map and the block bitmap so it runs after
+  whichever of them gets set up last.
+*/
+void
+myfs_count_group_inodes(myfs_info *myfs)
+{
+    int     g, ngroups = myfs->bbm.num_groups, ipg;
+    BVRange r;
+
+    if (myfs->ags == NULL || myfs->inode_map.bits == NULL || ngroups == 0)
+        return;
+
+    ipg = (myfs->dsb.num_inodes + ngroups - 1) / ngroups;
+    ipg = (ipg + 63) & ~63;
+    myfs->inodes_per_group = ipg;
+
+    for(g=0; g < ngroups; g++) {
+        SummarizeBV(&myfs->inode_map, g * ipg, ipg, &r);
+        myfs->ags[g].free_inodes = r.free;
+    }
 }
 
 
@@ -101,7 +440,8 @@ myfs_init_inodes(myfs_info *myfs)
     
     myfs->inode_map.bits    = calloc(1, myfs->dsb.num_inode_map_blocks*bsize);
     myfs->inode_map.numbits = myfs->dsb.num_inodes;
-    if (myfs->inode_map.bits == NULL)
+    myfs->inode_map_dirty   = calloc(1, myfs->dsb.num_inode_map_blocks);
+    if (myfs->inode_map.bits == NULL || myfs->inode_map_dirty == NULL)
         return ENOMEM;
 
     amt = read_blocks(myfs, myfs->dsb.inode_map_start,
@@ -111,7 +451,7 @@ myfs_init_inodes(myfs_info *myfs)
         return EINVAL;
     }
 
-    return 0;
+    return init_inode_cache(myfs);
 }
 
 
@@ -121,33 +461,174 @@ myfs_shutdown_inodes(myfs_info *myfs)
     free(myfs->inode_map.bits);
     myfs->inode_map.bits    = NULL;
     myfs->inode_map.numbits = 0;
+
+    if (myfs->inode_map_dirty)
+        free(myfs->inode_map_dirty);
+    myfs->inode_map_dirty = NULL;
+
+    shutdown_inode_cache(myfs);
+}
+
+
+/*
+  like the block bitmap, inode map blocks are only marked dirty when an
+  inode is allocated or freed and get written back at sync or unmount
+  time, in as few runs as possible.  the flag is cleared before the
+  block is copied out so a change that races with us is just written
+  again next time.
+*/
+static void
+mark_inode_map_dirty(myfs_info *myfs, inode_addr ia)
+{
+    int offset = ia / 8 / myfs->dsb.block_size;
+
+    if (offset >= myfs->dsb.num_inode_map_blocks) {
+        myfs_die("inode map offset %d is too big (max %ld)\n",
+                 offset, myfs->dsb.num_inode_map_blocks);
+    }
+
+    myfs->inode_map_dirty[offset] = 1;
+    mark_super_dirty(myfs);
+}
+
+
+int
+myfs_write_dirty_inode_map(myfs_info *myfs)
+{
+    int    bsize = myfs->dsb.block_size, err = 0;
+    int    i, n, nblocks = myfs->dsb.num_inode_map_blocks;
+    char  *ptr;
+
+    if (myfs->inode_map_dirty == NULL)
+        return 0;
+
+    for(i=0; i < nblocks; i = n + 1) {
+        for(n=i; n < nblocks && myfs->inode_map_dirty[n]; n++)
+            myfs->inode_map_dirty[n] = 0;
+
+        if (n == i)
+            continue;
+
+        ptr = (char *)myfs->inode_map.bits + (i * bsize);
+        if (write_blocks(myfs, myfs->dsb.inode_map_start + i, ptr, n - i)
+            != n - i) {
+            printf("error: failed to write back inode map blocks %ld:%d!\n",
+                   (long)(myfs->dsb.inode_map_start + i), n - i);
+            err = EIO;
+        }
+        myfs->map_writes++;
+    }
+
+    return err;
+}
+
+
+/*
+  take a free inode, trying group g first and then the ones after it.
+  in group g the search starts at near, so a file lands next to its
+  directory in the inode table.  each group's part of the inode map is
+  guarded by the group's lock; the free counts let us skip full groups
+  without taking it.
+*/
+static inode_addr
+take_free_inode(myfs_info *myfs, int g, inode_addr near)
+{
+    int         i, ngroups = myfs->bbm.num_groups, ipg;
+    inode_addr  ia, end;
+
+    if (myfs->ags == NULL || myfs->inodes_per_group == 0)
+        return GetFreeRangeOfBits(&myfs->inode_map, 1, NULL);
+
+    ipg = myfs->inodes_per_group;
+    if (near / ipg != g)
+        near = -1;
+
+    for(i=0; i < ngroups; i++, g = (g + 1) % ngroups, near = -1) {
+        if (myfs->ags[g].free_inodes <= 0)
+            continue;
+
+        end = (g + 1) * ipg;
+        if (end > myfs->dsb.num_inodes)
+            end = myfs->dsb.num_inodes;
+
+        acquire_sem(myfs->ags[g].sem);
+
+        ia = -1;
+        if (near > 0)
+            ia = FindFreeRangeBV(&myfs->inode_map, near, end, 1);
+        if (ia == -1 || ia >= end)
+            ia = FindFreeRangeBV(&myfs->inode_map, g * ipg, end, 1);
+        if (ia != -1 && ia < end) {
+            SetBV(&myfs->inode_map, ia);
+            myfs->ags[g].free_inodes--;
+            release_sem(myfs->ags[g].sem);
+            return ia;
+        }
+
+        release_sem(myfs->ags[g].sem);
+    }
+
+    return -1;
+}
+
+
+/*
+  directories are what spread a tree over the disk.  a new one goes in
+  the group with the most free blocks among those with at least the
+  average number of free inodes, looking from the group after its
+  parent's so that ties don't all end up in the same place.  the files
+  in it then stay in its group, inodes and data.
+*/
+static int
+find_dir_group(myfs_info *myfs, int parent_g)
+{
+    int   g, i, best = -1, ngroups = myfs->bbm.num_groups;
+    long  avg = 0, best_free = -1;
+
+    for(g=0; g < ngroups; g++)
+        avg += myfs->ags[g].free_inodes;
+    avg /= ngroups;
+
+    for(i=1; i <= ngroups; i++) {
+        g = (parent_g + i) % ngroups;
+        if (myfs->ags[g].free_inodes <= 0 || myfs->ags[g].free_inodes < avg)
+            continue;
+
+        if (myfs->bbm.groups[g].free > best_free) {
+            best      = g;
+            best_free = myfs->bbm.groups[g].free;
+        }
+    }
+
+    return (best >= 0) ? best : parent_g;
 }
 
 
 myfs_inode *
 myfs_allocate_inode(myfs_info *myfs, myfs_inode *parent, int mode)
 {
-    int         bsize = myfs->dsb.block_size;
-    int         offset;
-    char        tmp[IDENT_NAME_LENGTH];
-    char       *block;
+    int         g;
     inode_addr  ia;
     myfs_inode *mi;
 
-    mi = (myfs_inode *)calloc(1, sizeof(myfs_inode));
+    mi = myfs_get_inode(myfs, -1);
     if (mi == NULL)
         return NULL;
 
-    mi->etc = calloc(1, sizeof(myfs_inode_etc));
-    if (mi->etc == NULL) {
-        free(mi);
-        return NULL;
+    /*
+      files go in their parent directory's group, as close to it as
+      there's room.  directories get a group of their own.
+    */
+    g = 0;
+    if (parent && myfs->inodes_per_group) {
+        g = parent->inode_num / myfs->inodes_per_group;
+        if (MY_S_ISDIR(mode) && myfs->bbm.groups)
+            g = find_dir_group(myfs, g);
     }
 
-    ia = GetFreeRangeOfBits(&myfs->inode_map, 1, NULL);
+    ia = take_free_inode(myfs, g, parent ? parent->inode_num : -1);
     if (ia < 0) {
-        free(mi->etc);
-        free(mi);
+        myfs_put_inode(myfs, mi);
         printf("no inodes left!\n");
         return NULL;
     }
@@ -158,25 +639,15 @@ myfs_allocate_inode(myfs_info *myfs, myfs_inode *parent, int mode)
     mi->mode        = mode;
     mi->inode_num   = ia;
     mi->create_time = time(NULL);
+    if (INODE_SIZE(myfs) > sizeof(myfs_inode))
+        mi->flags   = INODE_INLINE;     /* until it outgrows the inode */
     mi->last_modified_time = mi->create_time;
 
-    sprintf(tmp, "ino#%ld", ia);
-    new_lock(&mi->etc->lock, tmp);
-
     /*
-      now we write the updated inode map back to disk.  we only write
-      the changed inode map block.  the inode itself will be written
-      later in update_inode().
+      the changed inode map block goes back to disk at the next sync.
+      the inode itself will be written later in update_inode().
     */
-    block = (char *)myfs->inode_map.bits;
-    offset = (ia / 8 / bsize);
-    if (offset >= myfs->dsb.num_inode_map_blocks) {
-        myfs_die("inode map offset %d is too big (max %ld)\n",
-                 offset, myfs->dsb.num_inode_map_blocks);
-    }
-    
-    write_blocks(myfs, myfs->dsb.inode_map_start+offset,
-                 &block[offset*bsize], 1);
+    mark_inode_map_dirty(myfs, ia);
 
 
     return mi;
@@ -186,23 +657,110 @@ myfs_allocate_inode(myfs_info *myfs, myfs_inode *parent, int mode)
 int
 myfs_free_inode(myfs_info *myfs, inode_addr ia)
 {
-    int   bsize = myfs->dsb.block_size;
-    int   offset;
-    char *block;
+    int   g;
     
-    UnSetBV(&myfs->inode_map, ia);
+    if (myfs->ags && myfs->inodes_per_group) {
+        g = ia / myfs->inodes_per_group;
+
+        acquire_sem(myfs->ags[g].sem);
+        UnSetBV(&myfs->inode_map, ia);
+        myfs->ags[g].free_inodes++;
+        release_sem(myfs->ags[g].sem);
+    } else {
+        UnSetBV(&myfs->inode_map, ia);
+    }
     
-    /* now update the on-disk inode map. */
-    block = (char *)myfs->inode_map.bits;
-    offset = (ia / 8 / bsize);
-    write_blocks(myfs, myfs->dsb.inode_map_start+offset,
-                 &block[offset*bsize], 1);
+    /* the on-disk inode map catches up at the next sync */
+    mark_inode_map_dirty(myfs, ia);
 
 
     return 0;
 }
 
 
+/*
+  dirty inodes.  a change that doesn't have to be on disk right away
+  (a write moving the size and mtime along) only marks the inode dirty
+  and puts it on a list.  it gets copied to the inode table once, at the
+  last close, fsync, sync or when the vnode goes away, however many
+  times it changed.  there's no flusher thread so whoever dirties an
+  inode writes back any that have been waiting too long.
+*/
+#define INODE_MAX_DIRTY_AGE  5000000    /* usecs before it's written back */
+
+static void
+unlink_dirty_inode(myfs_info *myfs, myfs_inode *mi)
+{
+    myfs_inode_etc *etc = mi->etc;
+
+    if (etc->dirty_prev)
+        etc->dirty_prev->etc->dirty_next = etc->dirty_next;
+    else
+        myfs->dirty_head = etc->dirty_next;
+
+    if (etc->dirty_next)
+        etc->dirty_next->etc->dirty_prev = etc->dirty_prev;
+    else
+        myfs->dirty_tail = etc->dirty_prev;
+
+    etc->dirty_next = etc->dirty_prev = NULL;
+    etc->dirty      = 0;
+}
+
+
+void
+mark_inode_dirty(myfs_info *myfs, myfs_inode *mi)
+{
+    myfs_inode_etc *etc = mi->etc;
+    bigtime_t       now;
+
+    myfs->inode_deferred++;
+    if (etc->dirty)
+        return;
+
+    now = system_time();
+
+    etc->dirty      = 1;
+    etc->dirty_time = now;
+    etc->dirty_next = NULL;
+    etc->dirty_prev = myfs->dirty_tail;
+    if (myfs->dirty_tail)
+        myfs->dirty_tail->etc->dirty_next = mi;
+    else
+        myfs->dirty_head = mi;
+    myfs->dirty_tail = mi;
+
+    while(myfs->dirty_head != mi &&
+          now - myfs->dirty_head->etc->dirty_time > INODE_MAX_DIRTY_AGE)
+        update_inode(myfs, myfs->dirty_head);
+}
+
+
+/* write an inode back if it has changes waiting */
+int
+myfs_write_inode(myfs_info *myfs, myfs_inode *mi)
+{
+    if (mi->etc->dirty == 0)
+        return 0;
+
+    return update_inode(myfs, mi);
+}
+
+
+int
+myfs_write_dirty_inodes(myfs_info *myfs)
+{
+    int err = 0;
+
+    while(myfs->dirty_head) {
+        if (update_inode(myfs, myfs->dirty_head) != 0)
+            err = EIO;
+    }
+
+    return err;
+}
+
+
 int
 update_inode(myfs_info *myfs, myfs_inode *mi)
 {
@@ -210,8 +768,13 @@ update_inode(myfs_info *myfs, myfs_inode *mi)
     char     *block;
     fs_off_t  addr; 
     
-    addr = myfs->dsb.inodes_start + ((mi->inode_num*sizeof(myfs_inode))/bsize);
-    offset = (mi->inode_num % (bsize / sizeof(myfs_inode)))*sizeof(myfs_inode);
+    if (mi->etc && mi->etc->dirty)
+        unlink_dirty_inode(myfs, mi);
+
+    myfs->inode_writes++;
+
+    addr = myfs->dsb.inodes_start + ((mi->inode_num*INODE_SIZE(myfs))/bsize);
+    offset = (mi->inode_num % (bsize / INODE_SIZE(myfs)))*INODE_SIZE(myfs);
     
     if (addr > myfs->dsb.inodes_start + myfs->dsb.num_inode_blocks)
         myfs_die("error updating inode %ld: addr %ld out of range (max %ld)\n",
@@ -222,6 +785,16 @@ update_inode(myfs_info *myfs, myfs_inode *mi)
     block = get_block(myfs->fd, addr, bsize);
     
     memcpy(&block[offset], mi, sizeof(myfs_inode));
+    if (mi->etc && mi->etc->inline_data)
+        memcpy(&block[offset + sizeof(myfs_inode)], mi->etc->inline_data,
+               INLINE_SIZE(myfs));
+
+    /* delayed data has no blocks yet so the size on disk stops short of it */
+    if (mi->etc && mi->etc->da_buf &&
+        mi->data.size > mi->etc->da_start) {
+        ((myfs_inode *)&block[offset])->data.size = mi->etc->da_start;
+    }
+
     mark_blocks_dirty(myfs->fd, addr, 1);
 
     release_block(myfs->fd, addr);
@@ -1,7 +1,16 @@
 int         myfs_create_inodes(myfs_info *myfs);
 int         myfs_init_inodes(myfs_info *myfs);
+void        myfs_count_group_inodes(myfs_info *myfs);
 void        myfs_shutdown_inodes(myfs_info *myfs);
+myfs_inode *myfs_get_inode(myfs_info *myfs, inode_addr ia);
+void        myfs_put_inode(myfs_info *myfs, myfs_inode *mi);
+int         myfs_load_inodes(myfs_info *myfs, inode_addr *ia, int n,
+                             myfs_inode **mis);
 myfs_inode *myfs_allocate_inode(myfs_info *myfs, myfs_inode *parent, int mode);
 int         myfs_free_inode(myfs_info *myfs, inode_addr ia);
+int         myfs_write_dirty_inode_map(myfs_info *myfs);
 int         update_inode(myfs_info *myfs, myfs_inode *mi);
+void        mark_inode_dirty(myfs_info *myfs, myfs_inode *mi);
+int         myfs_write_inode(myfs_info *myfs, myfs_inode *mi);
+int         myfs_write_dirty_inodes(myfs_info *myfs);
 
@@ -130,16 +130,58 @@ read_super_block(myfs_info *myfs)
     return 0;
 }
 
-int
-write_super_block(myfs_info *myfs)
+/*
+  the super block lives in memory and only goes to disk when its state
+  changes.  the first change after it was written clean puts MYFS_DIRTY
+  on disk so a crash from then on gets noticed at the next mount.  sync
+  and unmount write it back clean (with the current used_blocks) once
+  everything it describes is on disk.
+*/
+static int
+put_super_block(myfs_info *myfs)
 {
     ssize_t  amt;
+    char    *buff;
 
-    myfs->dsb.flags = MYFS_CLEAN;        /* now it's clean! */
-    amt = write_pos(myfs->fd, 0, &myfs->dsb, myfs->dsb.block_size);
+    /* the rest of the block stays zero for whatever gets added later */
+    buff = (char *)calloc(1, myfs->dsb.block_size);
+    if (buff == NULL)
+        return -1;
+
+    myfs->dsb.used_blocks = myfs_used_blocks(myfs);
+    memcpy(buff, &myfs->dsb, sizeof(myfs_super_block));
+
+    amt = write_pos(myfs->fd, 0, buff, myfs->dsb.block_size);
+    myfs->sb_writes++;
+
+    free(buff);
 
     if (amt == myfs->dsb.block_size)
         return 0;
     else
         return -1;
 }
+
+int
+mark_super_dirty(myfs_info *myfs)
+{
+    myfs->dsb.flags = MYFS_DIRTY;
+    if (myfs->sb_dirty)                  /* the disk already says so */
+        return 0;
+
+    myfs->sb_dirty = 1;
+
+    return put_super_block(myfs);
+}
+
+int
+write_super_block(myfs_info *myfs)
+{
+    myfs->dsb.flags = MYFS_CLEAN;        /* now it's clean! */
+    if (put_super_block(myfs) != 0)
+        return -1;
+
+    myfs->sb_dirty = 0;
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef _IORING_H
+#define _IORING_H
+
+/*
+  Submission/completion rings.  A caller fills in io_sqe's taken from
+  sys_io_get_sqe(), hands them to the ring with sys_io_submit() and
+  collects an io_cqe for each one with sys_io_reap().  Completions come
+  back in submission order and carry the sqe's user_data so the caller
+  can match them up.
+
+  An sqe marked IOSQE_LINK runs the next sqe only if it succeeded; if
+  it failed, the rest of the chain completes with ECANCELED.  An sqe
+  marked IOSQE_LINK_FD uses the fd returned by the last open or create
+  in its chain instead of its own fd field, which is how an
+  open -> read -> close chain gets built without a round trip.
+*/
+
+#define IORING_OP_NOP       0
+#define IORING_OP_OPEN      1       /* path, omode, perms -> fd */
+#define IORING_OP_CREATE    2       /* path, omode, perms -> fd */
+#define IORING_OP_CLOSE     3       /* fd */
+#define IORING_OP_READ      4       /* fd, buf, len, pos -> bytes read */
+#define IORING_OP_WRITE     5       /* fd, buf, len, pos -> bytes written */
+#define IORING_OP_STAT      6       /* fd and/or path, st */
+#define IORING_OP_UNLINK    7       /* path */
+#define IORING_OP_MAX       8
+
+#define IOSQE_LINK          0x0001  /* the next sqe depends on this one */
+#define IOSQE_LINK_FD       0x0002  /* use the fd opened earlier in the chain */
+
+typedef struct io_ring io_ring;
+
+typedef struct io_sqe {
+    int              op;
+    int              flags;
+    int              fd;
+    const char      *path;
+    void            *buf;
+    size_t           len;
+    fs_off_t         pos;           /* -1 means use the file position */
+    int              omode;
+    int              perms;
+    struct my_stat  *st;
+    void            *user_data;
+} io_sqe;
+
+typedef struct io_cqe {
+    void            *user_data;
+    long             res;           /* a result >= 0 or a negative error */
+} io_cqe;
+
+typedef struct io_ring_stats {
+    long             submitted;     /* sqe's handed to sys_io_submit */
+    long             completed;     /* cqe's posted, including failures */
+    long             failed;        /* completed with an error */
+    long             canceled;      /* skipped because a link failed */
+    long             submit_calls;
+    long             max_queued;    /* most sqe's ever waiting at once */
+    long             ops[IORING_OP_MAX];
+    bigtime_t        busy_time;     /* time spent executing requests */
+} io_ring_stats;
+
+io_ring *sys_io_ring_create(bool kernel, int entries);
+int      sys_io_ring_destroy(io_ring *ring);
+io_sqe  *sys_io_get_sqe(io_ring *ring);
+int      sys_io_submit(io_ring *ring);
+int      sys_io_reap(io_ring *ring, io_cqe *cqes, int max);
+int      sys_io_ring_stats(io_ring *ring, io_ring_stats *stats);
+
+#endif /* _IORING_H */
@@ -20,12 +20,14 @@
 #include "lock.h"
 #include "fsproto.h"
 #include "kprotos.h"
+#include "ioring.h"
 
 #include <sys/stat.h>
 
 #define     OMODE_MASK      (O_RDONLY | O_WRONLY | O_RDWR)
 #define     SLEEP_TIME      (10000.0)
 #define     MAX_SYM_LINKS   16
+#define     PATH_BUF_SIZE   256
 
 #define     FREE_LIST       0
 #define     USED_LIST       1
@@ -51,6 +53,8 @@ typedef struct nspace nspace;
 typedef struct ofile ofile;
 typedef struct ioctx ioctx;
 typedef struct fdarray fdarray;
+typedef struct path_buf path_buf;
+typedef struct path_comp path_comp;
 
 struct vnlist {
     vnode           *head;
@@ -129,6 +133,51 @@ struct fdarray {
     ofile           *fds[1];
 };
 
+/*
+ * a path being resolved.  it lives in buf, on the caller's stack, and
+ * only moves to the heap if it (or a symlink expansion of it) outgrows
+ * PATH_BUF_SIZE.
+ */
+
+struct path_buf {
+    char            *path;
+    char            buf[PATH_BUF_SIZE];
+};
+
+/*
+ * one component of a path, found in a single pass over it.  the hash
+ * is computed in the same pass so that anything keyed on names (a
+ * name cache, say) doesn't need to walk the name again.
+ */
+
+struct path_comp {
+    char            *name;
+    int             len;
+    ulong           hash;
+};
+
+/*
+ * a submission/completion ring.  the head and tail counters only ever
+ * increase; an index into sq or cq is the counter modulo its size.
+ */
+
+struct io_ring {
+    bool            kernel;
+    lock            lock;
+    int             sq_entries;
+    int             cq_entries;
+    io_sqe          *sq;
+    io_cqe          *cq;
+    ulong           sq_head;        /* next sqe to run */
+    ulong           sq_sub;         /* sqe's before this were submitted */
+    ulong           sq_tail;        /* next sqe to hand out */
+    ulong           cq_head;        /* next cqe to reap */
+    ulong           cq_tail;        /* next cqe to post */
+    int             link_fd;        /* fd opened earlier in the chain */
+    bool            link_failed;    /* an earlier link in the chain failed */
+    io_ring_stats   stats;
+};
+
 extern struct {
     const char *    name;
     vnode_ops *     ops;
@@ -165,16 +214,23 @@ static int      get_file_fd(bool kernel, int fd, const char *path,
                     int eatsymlink, vnode **vn);
 static int      get_file_vn(nspace_id nsid, vnode_id vnid, const char *path,
                     int eatsymlink, vnode **vn);
-static int      parse_path_fd(bool kerne, int fd, char **pstart,
+static int      parse_path_fd(bool kerne, int fd, path_buf *pb,
                     int eatsymlink, vnode **vn);
-static int      parse_path_vn(nspace_id nsid, vnode_id vnid, char **start,
+static int      parse_path_vn(nspace_id nsid, vnode_id vnid, path_buf *pb,
                     int eatsymlink, vnode **vn);
-static int      parse_path(vnode *bvn, char **pstart, char *path,
+static int      parse_path(vnode *bvn, path_buf *pb, char *path,
                     int eatsymlink, vnode **vn);
 
-static char *   cat_paths(char *a, char *b);
+static int      check_path(const char *path, int *size);
+static int      init_path_buf(path_buf *pb, const char *path);
+static void     free_path_buf(path_buf *pb);
+static int      splice_path_buf(path_buf *pb, const char *link,
+                    const char *rest);
+static char *   next_path_comp(char *p, path_comp *pc);
 
 static int      load_vnode(nspace_id nsid, vnode_id vnid, char r, vnode **vnp);
+static int      load_vnode_etc(nspace_id nsid, vnode_id vnid, char r,
+                    vnode **vnp, void **pre);
 static vnode *  lookup_vnode(nspace_id nsid, vnode_id vnid);
 static void     move_vnode(vnode *vn, int list);
 static vnode *  steal_vnode(int list);
@@ -201,6 +257,14 @@ static int          set_coe(bool kernel, int fd, int type, bool coe);
 static int          get_omode(bool kernel, int fd, int type, int *omode);
 static int          invoke_close(ofile *f);
 static int          invoke_free(ofile *f);
+static long         io_ring_run(io_ring *ring, io_sqe *sqe);
+static int          readdirplus_by_rstat(bool kernel, int fd, vnode *vn,
+                        void *cookie, long *num, struct my_direntplus *buf,
+                        size_t bufsize);
+static int          do_readv(bool kernel, int fd, fs_off_t *ppos,
+                             const struct iovec *vec, int count, size_t *lenp);
+static int          do_writev(bool kernel, int fd, fs_off_t *ppos,
+                              const struct iovec *vec, int count, size_t *lenp);
 
 static fdarray *    new_fds(int num);
 static int          free_fds(fdarray *fds);
@@ -681,14 +745,14 @@ sys_symlink(bool kernel, const char *oldpath, int nfd, const char *newpath)
 {
     int             err;
     char            filename[FILE_NAME_LENGTH];
-    char            *buf;
+    path_buf        pb;
     vnode           *dvn;
     op_symlink      *op;
 
     err = get_dir_fd(kernel, nfd, newpath, filename, &dvn);
     if (err)
         goto error1;
-    err = new_path(oldpath, &buf);
+    err = init_path_buf(&pb, oldpath);
     if (err)
         goto error2;
     op = dvn->ns->fs->ops.symlink;
@@ -696,17 +760,17 @@ sys_symlink(bool kernel, const char *oldpath, int nfd, const char *newpath)
         err = EINVAL;
         goto error3;
     }
-    err = (*op)(dvn->ns->data, dvn->data, filename, buf);
+    err = (*op)(dvn->ns->data, dvn->data, filename, pb.path);
     if (err)
         goto error3;
 
     dec_vnode(dvn, FALSE);
-    free_path(buf);
+    free_path_buf(&pb);
 
     return 0;
 
 error3:
-    free_path(buf);
+    free_path_buf(&pb);
 error2:
     dec_vnode(dvn, FALSE);
 error1:
@@ -888,7 +952,7 @@ sys_readdir(bool kernel, int fd, struct my_dirent *buf, size_t bufsize,
     err = (*vn->ns->fs->ops.readdir)(vn->ns->data, vn->data, f->cookie,
             &nm, buf, bufsize);
     if (err)
-        goto error1;
+        goto error2;
 
     /*
     patch the mount points and the root.
@@ -922,6 +986,126 @@ error1:
 }
 
 
+/*
+ * readdirplus.  like readdir but every entry comes back with a stat
+ * of what it names, which saves the caller a path walk per entry.
+ * one we can't stat comes back with its d_stat zeroed.
+ */
+
+int
+sys_readdirplus(bool kernel, int fd, struct my_direntplus *buf,
+        size_t bufsize, long count)
+{
+    ofile                *f;
+    int                   err;
+    vnode                *vn;
+    struct my_direntplus *p;
+    long                  i;
+    nspace_id             nsid;
+    vnode_id              vnid;
+    long                  nm;
+    int                   mounted;
+    op_readdirplus       *op;
+
+    f = get_fd(kernel, fd, FD_DIR);
+    if (!f) {
+        err = EBADF;
+        goto error1;
+    }
+    vn = f->vn;
+    nm = count;
+    op = vn->ns->fs->ops.readdirplus;
+    if (op)
+        err = (*op)(vn->ns->data, vn->data, f->cookie, &nm, buf, bufsize);
+    else
+        err = readdirplus_by_rstat(kernel, fd, vn, f->cookie, &nm, buf,
+                bufsize);
+    if (err)
+        goto error2;
+
+    /*
+    patch the mount points and the root.  their stat has to come from
+    the other side of the mount, so those few go the slow way.
+    */
+
+    nsid = vn->ns->nsid;
+    p = buf;
+    for(i=0; i<nm; i++) {
+        LOCK(vnlock);
+        mounted = is_mount_vnid(nsid, p->d_ent.d_ino, &vnid);
+        UNLOCK(vnlock);
+        if (mounted || (vn->ns->mount && !strcmp(p->d_ent.d_name, ".."))) {
+            if (sys_rstat(kernel, fd, p->d_ent.d_name, &p->d_stat, FALSE))
+                memset(&p->d_stat, 0, sizeof(p->d_stat));
+            else
+                p->d_ent.d_ino = p->d_stat.ino;
+        }
+        p = (struct my_direntplus *) ((char *) p + p->d_ent.d_reclen);
+    }
+
+    put_fd(f);
+    return nm;
+
+error2:
+    put_fd(f);
+error1:
+    if (err > 0)        /* so it can't pass for a count */
+        err = -err;
+
+    return err;
+}
+
+/*
+ * readdirplus for file systems that don't have the op: one readdir
+ * and one rstat per entry.  we only pull the next entry off the
+ * cookie when a maximal record is sure to fit so none get dropped.
+ */
+
+static int
+readdirplus_by_rstat(bool kernel, int fd, vnode *vn, void *cookie,
+        long *num, struct my_direntplus *buf, size_t bufsize)
+{
+    long long             tmp[(sizeof(struct my_dirent) +
+                               FILE_NAME_LENGTH + 7) / 8];
+    struct my_dirent     *de;
+    struct my_direntplus *p;
+    size_t                rl, left;
+    long                  i, n;
+    int                   err;
+
+    de = (struct my_dirent *) tmp;
+    p = buf;
+    left = bufsize;
+    err = 0;
+    for(i=0; i<*num; i++) {
+        if (left < sizeof(struct my_direntplus) + FILE_NAME_LENGTH) {
+            if (i == 0)
+                err = EINVAL;
+            break;
+        }
+        n = 1;
+        err = (*vn->ns->fs->ops.readdir)(vn->ns->data, vn->data, cookie,
+                &n, de, sizeof(tmp));
+        if (err || (n == 0))
+            break;
+        rl = offsetof(struct my_direntplus, d_ent.d_name) +
+                strlen(de->d_name) + 1;
+        p->d_ent.d_dev = de->d_dev;
+        p->d_ent.d_ino = de->d_ino;
+        p->d_ent.d_reclen = (rl + 7) & ~7;
+        strcpy(p->d_ent.d_name, de->d_name);
+        if (sys_rstat(kernel, fd, de->d_name, &p->d_stat, FALSE))
+            memset(&p->d_stat, 0, sizeof(p->d_stat));
+        left -= p->d_ent.d_reclen;
+        p = (struct my_direntplus *) ((char *) p + p->d_ent.d_reclen);
+    }
+    if (i > 0)          /* hand back what we have, the error keeps */
+        err = 0;
+    *num = i;
+    return err;
+}
+
+
 /*
  * rewinddir
  */
@@ -1226,6 +1410,205 @@ error1:
 }
 
 
+/*
+ * sys_pread, sys_pwrite, sys_readv, sys_writev, sys_preadv, sys_pwritev
+ *
+ * the positional calls neither use nor update f->pos, so several
+ * readers can share one fd without serializing on an lseek+read
+ * pair.  the vectored calls hand the whole iovec to the file system
+ * when it has a readv/writev op and otherwise fall back to one
+ * read/write per vector.
+ */
+
+ssize_t
+sys_pread(bool kernel, int fd, fs_off_t pos, void *buf, size_t len)
+{
+    struct iovec    vec;
+    int             err;
+
+    vec.iov_base = buf;
+    vec.iov_len = len;
+    err = do_readv(kernel, fd, &pos, &vec, 1, &len);
+    return err ? err : len;
+}
+
+ssize_t
+sys_pwrite(bool kernel, int fd, fs_off_t pos, void *buf, size_t len)
+{
+    struct iovec    vec;
+    int             err;
+
+    vec.iov_base = buf;
+    vec.iov_len = len;
+    err = do_writev(kernel, fd, &pos, &vec, 1, &len);
+    return err ? err : len;
+}
+
+ssize_t
+sys_readv(bool kernel, int fd, const struct iovec *vec, int count)
+{
+    size_t          len;
+    int             err;
+
+    err = do_readv(kernel, fd, NULL, vec, count, &len);
+    return err ? err : len;
+}
+
+ssize_t
+sys_writev(bool kernel, int fd, const struct iovec *vec, int count)
+{
+    size_t          len;
+    int             err;
+
+    err = do_writev(kernel, fd, NULL, vec, count, &len);
+    return err ? err : len;
+}
+
+ssize_t
+sys_preadv(bool kernel, int fd, fs_off_t pos, const struct iovec *vec,
+           int count)
+{
+    size_t          len;
+    int             err;
+
+    err = do_readv(kernel, fd, &pos, vec, count, &len);
+    return err ? err : len;
+}
+
+ssize_t
+sys_pwritev(bool kernel, int fd, fs_off_t pos, const struct iovec *vec,
+            int count)
+{
+    size_t          len;
+    int             err;
+
+    err = do_writev(kernel, fd, &pos, vec, count, &len);
+    return err ? err : len;
+}
+
+
+static int
+do_readv(bool kernel, int fd, fs_off_t *ppos, const struct iovec *vec,
+         int count, size_t *lenp)
+{
+    ofile       *f;
+    int         err, i;
+    vnode       *vn;
+    size_t      sz, len;
+    fs_off_t    pos;
+    op_readv    *op;
+
+    if ((count < 0) || (ppos && (*ppos < 0))) {
+        err = EINVAL;
+        goto error1;
+    }
+    f = get_fd(kernel, fd, FD_FILE);
+    if (!f) {
+        err = EBADF;
+        goto error1;
+    }
+    if ((f->omode & OMODE_MASK) == O_WRONLY) {
+        err = EBADF;
+        goto error2;
+    }
+    vn = f->vn;
+    pos = ppos ? *ppos : f->pos;
+    len = 0;
+    op = vn->ns->fs->ops.readv;
+    if (op) {
+        err = (*op)(vn->ns->data, vn->data, f->cookie, pos, vec, count, &len);
+        if (err)
+            goto error2;
+    } else {
+        for(i=0; i<count; i++) {
+            sz = vec[i].iov_len;
+            err = (*vn->ns->fs->ops.read)(vn->ns->data, vn->data, f->cookie,
+                pos + len, vec[i].iov_base, &sz);
+            if (err) {
+                if (len == 0)
+                    goto error2;
+                break;
+            }
+            len += sz;
+            if (sz < vec[i].iov_len)
+                break;
+        }
+    }
+
+    if (!ppos)
+        f->pos += len;
+
+    put_fd(f);
+    *lenp = len;
+    return 0;
+
+error2:
+    put_fd(f);
+error1:
+    return err;
+}
+
+static int
+do_writev(bool kernel, int fd, fs_off_t *ppos, const struct iovec *vec,
+          int count, size_t *lenp)
+{
+    ofile       *f;
+    int         err, i;
+    vnode       *vn;
+    size_t      sz, len;
+    fs_off_t    pos;
+    op_writev   *op;
+
+    if ((count < 0) || (ppos && (*ppos < 0))) {
+        err = EINVAL;
+        goto error1;
+    }
+    f = get_fd(kernel, fd, FD_FILE);
+    if (!f) {
+        err = EBADF;
+        goto error1;
+    }
+    if ((f->omode & OMODE_MASK) == O_RDONLY) {
+        err = EBADF;
+        goto error2;
+    }
+    vn = f->vn;
+    pos = ppos ? *ppos : f->pos;
+    len = 0;
+    op = vn->ns->fs->ops.writev;
+    if (op) {
+        err = (*op)(vn->ns->data, vn->data, f->cookie, pos, vec, count, &len);
+        if (err)
+            goto error2;
+    } else {
+        for(i=0; i<count; i++) {
+            sz = vec[i].iov_len;
+            err = (*vn->ns->fs->ops.write)(vn->ns->data, vn->data, f->cookie,
+                pos + len, vec[i].iov_base, &sz);
+            if (err) {
+                if (len == 0)
+                    goto error2;
+                break;
+            }
+            len += sz;
+            if (sz < vec[i].iov_len)
+                break;
+        }
+    }
+
+    if (!ppos)
+        f->pos += len;
+
+    put_fd(f);
+    *lenp = len;
+    return 0;
+
+error2:
+    put_fd(f);
+error1:
+    return err;
+}
+
 
 /*
  * sys_ioctl
@@ -1263,6 +1646,54 @@ error1:
 }
 
 
+/*
+ * sys_fallocate
+ *
+ * give pos..pos+len of a file its blocks without writing any data.
+ * mode is a mask of MY_FALLOC_KEEP_SIZE and MY_FALLOC_UNWRITTEN.
+ */
+
+int
+sys_fallocate(bool kernel, int fd, int mode, fs_off_t pos, fs_off_t len)
+{
+    ofile           *f;
+    int             err;
+    vnode           *vn;
+    op_fallocate    *op;
+
+    if ((pos < 0) || (len <= 0) ||
+        (mode & ~(MY_FALLOC_KEEP_SIZE | MY_FALLOC_UNWRITTEN))) {
+        err = EINVAL;
+        goto error1;
+    }
+    f = get_fd(kernel, fd, FD_FILE);
+    if (!f) {
+        err = EBADF;
+        goto error1;
+    }
+    if ((f->omode & OMODE_MASK) == O_RDONLY) {
+        err = EBADF;
+        goto error2;
+    }
+    vn = f->vn;
+    op = vn->ns->fs->ops.fallocate;
+    if (op)
+        err = (*op)(vn->ns->data, vn->data, f->cookie, mode, pos, len);
+    else
+        err = EINVAL;
+    if (err)
+        goto error2;
+
+    put_fd(f);
+    return 0;
+
+error2:
+    put_fd(f);
+error1:
+    return err;
+}
+
+
 /*
  * sys_link
  */
@@ -1725,6 +2156,252 @@ error1:
 }
 
 
+/*
+ * submission/completion rings.
+ *
+ * requests are run by a ring worker that pulls sqe's off the ring in
+ * order and posts a cqe for each.  there are no kernel threads to give
+ * that job to here, so sys_io_submit runs the worker loop itself until
+ * the submission ring is empty or the completion ring is full.  a
+ * caller that reaps and submits again picks up where it left off,
+ * chains included.
+ */
+
+io_ring *
+sys_io_ring_create(bool kernel, int entries)
+{
+    io_ring     *ring;
+
+    if (entries <= 0)
+        goto error1;
+    ring = (io_ring *) calloc(sizeof(io_ring), 1);
+    if (!ring)
+        goto error1;
+    ring->sq = (io_sqe *) calloc(sizeof(io_sqe), entries);
+    if (!ring->sq)
+        goto error2;
+    ring->cq = (io_cqe *) calloc(sizeof(io_cqe), 2*entries);
+    if (!ring->cq)
+        goto error3;
+    if (new_lock(&ring->lock, "io ring") != 0)
+        goto error4;
+
+    ring->kernel = kernel;
+    ring->sq_entries = entries;
+    ring->cq_entries = 2*entries;
+    ring->link_fd = -1;
+    return ring;
+
+error4:
+    free(ring->cq);
+error3:
+    free(ring->sq);
+error2:
+    free(ring);
+error1:
+    return NULL;
+}
+
+int
+sys_io_ring_destroy(io_ring *ring)
+{
+    LOCK(ring->lock);
+    if (ring->sq_head != ring->sq_tail) {
+        UNLOCK(ring->lock);
+        return EBUSY;
+    }
+    UNLOCK(ring->lock);
+
+    free_lock(&ring->lock);
+    free(ring->cq);
+    free(ring->sq);
+    free(ring);
+    return 0;
+}
+
+/*
+ * hand out the next free sqe, cleared and with fd and pos set to -1.
+ * returns NULL if the submission ring is full.
+ */
+
+io_sqe *
+sys_io_get_sqe(io_ring *ring)
+{
+    io_sqe      *sqe;
+
+    LOCK(ring->lock);
+    if (ring->sq_tail - ring->sq_head >= ring->sq_entries) {
+        UNLOCK(ring->lock);
+        return NULL;
+    }
+    sqe = &ring->sq[ring->sq_tail % ring->sq_entries];
+    memset(sqe, 0, sizeof(io_sqe));
+    sqe->fd = -1;
+    sqe->pos = -1;
+    ring->sq_tail++;
+    UNLOCK(ring->lock);
+    return sqe;
+}
+
+/*
+ * submit everything handed out so far and run it.  returns the number
+ * of requests completed by this call.
+ */
+
+int
+sys_io_submit(io_ring *ring)
+{
+    io_sqe      *sqe;
+    io_cqe      *cqe;
+    long        res, queued;
+    int         n;
+    bigtime_t   start;
+
+    LOCK(ring->lock);
+    ring->stats.submit_calls++;
+    ring->stats.submitted += ring->sq_tail - ring->sq_sub;
+    ring->sq_sub = ring->sq_tail;
+    queued = ring->sq_tail - ring->sq_head;
+    if (queued > ring->stats.max_queued)
+        ring->stats.max_queued = queued;
+
+    start = system_time();
+    for(n=0; ring->sq_head != ring->sq_tail; n++) {
+        if (ring->cq_tail - ring->cq_head >= ring->cq_entries)
+            break;
+        sqe = &ring->sq[ring->sq_head % ring->sq_entries];
+        res = io_ring_run(ring, sqe);
+        cqe = &ring->cq[ring->cq_tail % ring->cq_entries];
+        cqe->user_data = sqe->user_data;
+        cqe->res = res;
+        ring->sq_head++;
+        ring->cq_tail++;
+    }
+    ring->stats.busy_time += system_time() - start;
+    UNLOCK(ring->lock);
+
+    return n;
+}
+
+/*
+ * copy out up to max completions.  returns how many there were.
+ */
+
+int
+sys_io_reap(io_ring *ring, io_cqe *cqes, int max)
+{
+    int         n;
+
+    LOCK(ring->lock);
+    for(n=0; (n < max) && (ring->cq_head != ring->cq_tail); n++) {
+        cqes[n] = ring->cq[ring->cq_head % ring->cq_entries];
+        ring->cq_head++;
+    }
+    UNLOCK(ring->lock);
+
+    return n;
+}
+
+int
+sys_io_ring_stats(io_ring *ring, io_ring_stats *stats)
+{
+    LOCK(ring->lock);
+    *stats = ring->stats;
+    UNLOCK(ring->lock);
+    return 0;
+}
+
+/*
+ * run one request.  this is the ring worker.  a chain that has failed
+ * cancels the rest of its links, except that a close of the chain's fd
+ * still happens so an open -> read -> close chain can't leak the fd.
+ */
+
+static long
+io_ring_run(io_ring *ring, io_sqe *sqe)
+{
+    int             err, fd, omode;
+    long            res;
+    size_t          len;
+    struct iovec    vec;
+
+    fd = sqe->fd;
+    if (sqe->flags & IOSQE_LINK_FD)
+        fd = ring->link_fd;
+
+    err = 0;
+    res = 0;
+    if (ring->link_failed &&
+        !((sqe->op == IORING_OP_CLOSE) && (sqe->flags & IOSQE_LINK_FD) &&
+          (fd >= 0))) {
+        err = ECANCELED;
+        ring->stats.canceled++;
+        goto done;
+    }
+
+    switch(sqe->op) {
+    case IORING_OP_NOP:
+        break;
+    case IORING_OP_OPEN:
+    case IORING_OP_CREATE:
+        omode = sqe->omode;
+        if (sqe->op == IORING_OP_CREATE)
+            omode |= O_CREAT;
+        res = sys_open(ring->kernel, fd, sqe->path, omode, sqe->perms,
+                FALSE);
+        if (res < 0)
+            err = res;
+        else
+            ring->link_fd = res;
+        break;
+    case IORING_OP_CLOSE:
+        err = sys_close(ring->kernel, fd);
+        if (fd == ring->link_fd)
+            ring->link_fd = -1;
+        break;
+    case IORING_OP_READ:
+    case IORING_OP_WRITE:
+        vec.iov_base = sqe->buf;
+        vec.iov_len = sqe->len;
+        len = 0;
+        if (sqe->op == IORING_OP_READ)
+            err = do_readv(ring->kernel, fd, (sqe->pos < 0) ? NULL : &sqe->pos,
+                    &vec, 1, &len);
+        else
+            err = do_writev(ring->kernel, fd, (sqe->pos < 0) ? NULL : &sqe->pos,
+                    &vec, 1, &len);
+        res = len;
+        break;
+    case IORING_OP_STAT:
+        err = sys_rstat(ring->kernel, fd, sqe->path, sqe->st, TRUE);
+        break;
+    case IORING_OP_UNLINK:
+        err = sys_unlink(ring->kernel, fd, sqe->path);
+        break;
+    default:
+        err = EINVAL;
+        break;
+    }
+    if ((sqe->op >= 0) && (sqe->op < IORING_OP_MAX))
+        ring->stats.ops[sqe->op]++;
+
+done:
+    if (err) {
+        res = (err > 0) ? -err : err;
+        if (err != ECANCELED)
+            ring->stats.failed++;
+        if (sqe->flags & IOSQE_LINK)
+            ring->link_failed = TRUE;
+    }
+    if (!(sqe->flags & IOSQE_LINK)) {
+        ring->link_failed = FALSE;
+        ring->link_fd = -1;
+    }
+    ring->stats.completed++;
+    return res;
+}
+
+
 /*
  * get_dir and get_file: basic functions to parse a path and get the vnode
  * for either the parent directory or the file itself.
@@ -1735,10 +2412,12 @@ get_dir_fd(bool kernel, int fd, const char *path, char *filename, vnode **dvn)
 {
     int         err;
     char        *p, *np;
+    path_buf    pb;
 
-    err = new_path(path, &p);
+    err = init_path_buf(&pb, path);
     if (err)
         goto error1;
+    p = pb.path;
     np = strrchr(p, '/');
     if (!np) {
         strcpy(filename, p);
@@ -1748,14 +2427,14 @@ get_dir_fd(bool kernel, int fd, const char *path, char *filename, vnode **dvn)
         np[1] = '.';
         np[2] = '\0';
     }
-    err = parse_path_fd(kernel, fd, &p, TRUE, dvn);
+    err = parse_path_fd(kernel, fd, &pb, TRUE, dvn);
     if (err)
         goto error2;
-    free_path(p);
+    free_path_buf(&pb);
     return 0;
     
 error2:
-    free_path(p);
+    free_path_buf(&pb);
 error1:
     return err;
 }
@@ -1764,19 +2443,19 @@ static int
 get_file_fd(bool kernel, int fd, const char *path, int eatsymlink, vnode **vn)
 {
     int         err;
-    char        *p;
+    path_buf    pb;
 
-    err = new_path(path, &p);
+    err = init_path_buf(&pb, path);
     if (err)
         goto error1;
-    err = parse_path_fd(kernel, fd, &p, eatsymlink, vn);
+    err = parse_path_fd(kernel, fd, &pb, eatsymlink, vn);
     if (err)
         goto error2;
-    free_path(p);
+    free_path_buf(&pb);
     return 0;
     
 error2:
-    free_path(p);
+    free_path_buf(&pb);
 error1:
     return err;
 }
@@ -1786,32 +2465,32 @@ get_file_vn(nspace_id nsid, vnode_id vnid, const char *path, int eatsymlink,
         vnode **vn)
 {
     int         err;
-    char        *p;
+    path_buf    pb;
 
-    err = new_path(path, &p);
+    err = init_path_buf(&pb, path);
     if (err)
         goto error1;
-    err = parse_path_vn(nsid, vnid, &p, eatsymlink, vn);
+    err = parse_path_vn(nsid, vnid, &pb, eatsymlink, vn);
     if (err)
         goto error2;
-    free_path(p);
+    free_path_buf(&pb);
     return 0;
     
 error2:
-    free_path(p);
+    free_path_buf(&pb);
 error1:
     return err;
 }
 
 static int
-parse_path_fd(bool kernel, int fd, char **pstart, int eatsymlink, vnode **vnp)
+parse_path_fd(bool kernel, int fd, path_buf *pb, int eatsymlink, vnode **vnp)
 {
     vnode           *bvn;
     ofile           *f;
     ioctx           *io;
     char            *path;
 
-    path = *pstart;
+    path = pb->path;
     if (path && (*path == '/')) {
         do
             path++;
@@ -1833,18 +2512,18 @@ parse_path_fd(bool kernel, int fd, char **pstart, int eatsymlink, vnode **vnp)
             inc_vnode(bvn);
             UNLOCK(io->lock);
         }
-    return parse_path(bvn, pstart, path, eatsymlink, vnp);
+    return parse_path(bvn, pb, path, eatsymlink, vnp);
 }
 
 static int
-parse_path_vn(nspace_id nsid, vnode_id vnid, char **pstart, int eatsymlink,
+parse_path_vn(nspace_id nsid, vnode_id vnid, path_buf *pb, int eatsymlink,
     vnode **vnp)
 {
     int             err;
     vnode           *bvn;
     char            *path;
 
-    path = *pstart;
+    path = pb->path;
     if (path && (*path == '/')) {
         do
             path++;
@@ -1856,7 +2535,7 @@ parse_path_vn(nspace_id nsid, vnode_id vnid, char **pstart, int eatsymlink,
         if (err)
             return err;
     }
-    return parse_path(bvn, pstart, path, eatsymlink, vnp);
+    return parse_path(bvn, pb, path, eatsymlink, vnp);
 
 error1:
     dec_vnode(bvn, FALSE);
@@ -1864,13 +2543,14 @@ error1:
 }
 
 static int
-parse_path(vnode *bvn, char **pstart, char *path, int eatsymlink, vnode **vnp)
+parse_path(vnode *bvn, path_buf *pb, char *path, int eatsymlink, vnode **vnp)
 {
     int             err;
     int             iter;
     char            *p, *np, *newpath, **fred;
     vnode_id        vnid;
     vnode           *vn;
+    path_comp       pc;
 
     if (!path) {
         *vnp = bvn;
@@ -1896,20 +2576,14 @@ parse_path(vnode *bvn, char **pstart, char *path, int eatsymlink, vnode **vnp)
     isolate the next component
     */
 
-        np = strchr(p+1, '/');
-        if (np) {
-            *np = '\0';
-            do
-                np++;
-            while (*np == '/');
-        } else
-            np = strchr(p+1, '\0');
+        np = next_path_comp(p, &pc);
         
     /*
     filter '..' if at the root of a namespace
     */
 
-        if (!strcmp(p, "..") && is_root(bvn, &vn)) {
+        if ((pc.len == 2) && (p[0] == '.') && (p[1] == '.') &&
+            is_root(bvn, &vn)) {
             dec_vnode(bvn, FALSE);
             bvn = vn;
         }
@@ -1923,8 +2597,8 @@ parse_path(vnode *bvn, char **pstart, char *path, int eatsymlink, vnode **vnp)
         if (!eatsymlink && (*np == '\0'))
             fred = NULL;
 
-        err = (*bvn->ns->fs->ops.walk)(bvn->ns->data, bvn->data, p, fred,
-                &vnid);
+        err = (*bvn->ns->fs->ops.walk)(bvn->ns->data, bvn->data, pc.name,
+                fred, &vnid);
         p = np;
         if (!err) {
             if (newpath)
@@ -1957,14 +2631,13 @@ parse_path(vnode *bvn, char **pstart, char *path, int eatsymlink, vnode **vnp)
                 break;
             }
 
-            p = cat_paths(newpath, np);
-            if (!p) {
+            err = splice_path_buf(pb, newpath, np);
+            free_path(newpath);
+            if (err) {
                 dec_vnode(vn, FALSE);
-                err = ENOMEM;
                 break;
             }
-            free_path(*pstart);
-            *pstart = p;
+            p = pb->path;
             if (*p == '/') {
                 do
                     p++;
@@ -2015,6 +2688,76 @@ get_vnode(nspace_id nsid, vnode_id vnid, void **data)
 }
 
 
+/*
+ * get_vnodes -- get_vnode() on n vnodes at once.  the ones that aren't
+ * loaded yet are read with one call to the file system's read_vnodes
+ * op, if it has one, so it can decode several from the same block
+ * (vnids should be sorted for that).  on error none of them are held.
+ */
+
+int
+get_vnodes(nspace_id nsid, vnode_id *vnids, int n, void **data)
+{
+    int              i, j, err = 0, nload = 0;
+    nspace          *ns;
+    vnode           *vn;
+    vnode_id        *ids = NULL;
+    void           **pre = NULL, **p;
+    op_read_vnodes  *op = NULL;
+
+    LOCK(vnlock);
+    ns = nsidtons(nsid);
+    if (ns)
+        op = ns->fs->ops.read_vnodes;
+    UNLOCK(vnlock);
+
+    if (op && n > 1) {
+        ids = (vnode_id *)malloc(n * sizeof(vnode_id));
+        pre = (void **)calloc(n, sizeof(void *));
+    }
+
+    if (ids && pre) {
+        LOCK(vnlock);
+        for(i=0; i < n; i++)
+            if (lookup_vnode(nsid, vnids[i]) == NULL)
+                ids[nload++] = vnids[i];
+        UNLOCK(vnlock);
+
+        /* if the batch fails they're just loaded one at a time */
+        if (nload && (*op)(ns->data, ids, nload, TRUE, pre) != 0)
+            nload = 0;
+    }
+
+    for(i=0, j=0; i < n; i++) {
+        p = NULL;
+        if (j < nload && ids[j] == vnids[i])
+            p = &pre[j++];
+
+        err = load_vnode_etc(nsid, vnids[i], TRUE, &vn, p);
+        if (err)
+            break;
+        data[i] = vn->data;
+    }
+
+    if (err) {
+        while(--i >= 0)
+            put_vnode(nsid, vnids[i]);
+    }
+
+    /* ones somebody else loaded first (or that we never got to) go back */
+    for(j=0; j < nload; j++)
+        if (pre[j])
+            (*ns->fs->ops.release_vnode)(ns->data, pre[j], TRUE);
+
+    if (ids)
+        free(ids);
+    if (pre)
+        free(pre);
+
+    return err;
+}
+
+
 /*
  * put_vnode
  */
@@ -2277,6 +3020,17 @@ lookup_vnode(nspace_id nsid, vnode_id vnid)
 
 static int
 load_vnode(nspace_id nsid, vnode_id vnid, char r, vnode **vnp)
+{
+    return load_vnode_etc(nsid, vnid, r, vnp, NULL);
+}
+
+/*
+ * if pre points at a node the file system already read for this vnid
+ * it's used instead of calling read_vnode (and *pre is cleared).
+ */
+static int
+load_vnode_etc(nspace_id nsid, vnode_id vnid, char r, vnode **vnp,
+               void **pre)
 {
     int             err;
     vnode           *vn;
@@ -2318,7 +3072,14 @@ load_vnode(nspace_id nsid, vnode_id vnid, char r, vnode **vnp)
             goto error2;
         move_vnode(vn, LOCKED_LIST);
         UNLOCK(vnlock);
-        err = (*vn->ns->fs->ops.read_vnode)(vn->ns->data, vnid, r, &vn->data);
+        if (pre && *pre) {
+            vn->data = *pre;
+            *pre = NULL;
+            err = 0;
+        } else {
+            err = (*vn->ns->fs->ops.read_vnode)(vn->ns->data, vnid, r,
+                                                &vn->data);
+        }
         LOCK(vnlock);
         vn->busy = FALSE;
         if (err)
@@ -2363,17 +3124,18 @@ compare_vnode(vnode *vna, vnode *vnb)
  * path management functions
  */
 
-int
-new_path(const char *path, char **copy)
+/*
+ * check_path makes sure a path (and every name in it) isn't too long
+ * and returns how many bytes a copy of it needs, counting the '.' that
+ * gets tacked on to a path with a trailing '/'.
+ */
+
+static int
+check_path(const char *path, int *size)
 {
     const char  *q, *r;
-    char        *p;
     int         l, s;
 
-    if (!path) {
-        *copy = NULL;
-        return 0;
-    }
     l = strlen(path);
     if (l == 0)
         return ENOENT;
@@ -2395,12 +3157,31 @@ new_path(const char *path, char **copy)
             return ENAMETOOLONG;        
     }
 
-    p = (char *) malloc(s+1);
+    *size = s+1;
+    return 0;
+}
+
+int
+new_path(const char *path, char **copy)
+{
+    char        *p;
+    int         l, s, err;
+
+    if (!path) {
+        *copy = NULL;
+        return 0;
+    }
+    err = check_path(path, &s);
+    if (err)
+        return err;
+
+    p = (char *) malloc(s);
     if (!p)
         return ENOMEM;
 
     /* ### do real checking: MAXPATHLEN, max file name len, buffer address... */
 
+    l = strlen(path);
     strcpy(p, path);    
     if (p[l-1] == '/') {
         p[l] = '.';
@@ -2410,27 +3191,119 @@ new_path(const char *path, char **copy)
     return 0;
 }
 
-void
-free_path(char *p)
+/*
+ * the same as new_path but the copy goes in the path_buf, which
+ * keeps it off the heap unless it's a very long path.
+ */
+
+static int
+init_path_buf(path_buf *pb, const char *path)
 {
-    if (p) {
-        free(p);
+    int         l, s, err;
+
+    if (!path) {
+        pb->path = NULL;
+        return 0;
+    }
+    err = check_path(path, &s);
+    if (err)
+        return err;
+
+    if (s <= PATH_BUF_SIZE)
+        pb->path = pb->buf;
+    else {
+        pb->path = (char *) malloc(s);
+        if (!pb->path)
+            return ENOMEM;
     }
+
+    l = strlen(path);
+    memcpy(pb->path, path, l+1);
+    if (path[l-1] == '/') {
+        pb->path[l] = '.';
+        pb->path[l+1] = '\0';
+    }
+    return 0;
 }
 
-static char *
-cat_paths(char *a, char *b)
+static void
+free_path_buf(path_buf *pb)
+{
+    if (pb->path && (pb->path != pb->buf))
+        free(pb->path);
+    pb->path = NULL;
+}
+
+/*
+ * splice_path_buf replaces the path with link + "/" + rest, where rest
+ * is what's left of the current path (and so may point into it).
+ */
+
+static int
+splice_path_buf(path_buf *pb, const char *link, const char *rest)
 {
     char        *p;
+    size_t      ll, rl;
 
-    p = (char *) realloc(a, strlen(a) + strlen(b) + 2);
-    if (!p)
-        return NULL;
-    strcat(p, "/");
-    strcat(p, b);
+    ll = strlen(link);
+    rl = strlen(rest);
+    if (ll + rl + 1 >= MAXPATHLEN)
+        return ENAMETOOLONG;
+
+    if (ll + rl + 2 <= PATH_BUF_SIZE)
+        p = pb->buf;
+    else {
+        p = (char *) malloc(ll + rl + 2);
+        if (!p)
+            return ENOMEM;
+    }
+
+    memmove(p + ll + 1, rest, rl + 1);
+    memcpy(p, link, ll);
+    p[ll] = '/';
+
+    if (pb->path != p)
+        free_path_buf(pb);
+    pb->path = p;
+    return 0;
+}
+
+/*
+ * next_path_comp null terminates the component at p and fills in pc.
+ * it returns where the next component starts (or the terminating
+ * '\0' if this was the last one).
+ */
+
+static char *
+next_path_comp(char *p, path_comp *pc)
+{
+    ulong       h;
+
+    h = 5381;
+    pc->name = p;
+    while ((*p != '/') && (*p != '\0')) {
+        h = ((h << 5) + h) + (uchar) *p;
+        p++;
+    }
+    pc->len = p - pc->name;
+    pc->hash = h;
+
+    if (*p == '/') {
+        *p++ = '\0';
+        while (*p == '/')
+            p++;
+    }
     return p;
 }
 
+void
+free_path(char *p)
+{
+    if (p) {
+        free(p);
+    }
+}
+
 /* 
  * mount point management functions
  */
@@ -9,7 +9,16 @@ int sys_close(bool kernel, int fd);
 fs_off_t sys_lseek(bool kernel, int fd, fs_off_t pos, int whence);
 ssize_t sys_read(bool kernel, int fd, void *buf, size_t len);
 ssize_t sys_write(bool kernel, int fd, void *buf, size_t len);
+ssize_t sys_pread(bool kernel, int fd, fs_off_t pos, void *buf, size_t len);
+ssize_t sys_pwrite(bool kernel, int fd, fs_off_t pos, void *buf, size_t len);
+ssize_t sys_readv(bool kernel, int fd, const struct iovec *vec, int count);
+ssize_t sys_writev(bool kernel, int fd, const struct iovec *vec, int count);
+ssize_t sys_preadv(bool kernel, int fd, fs_off_t pos,
+                   const struct iovec *vec, int count);
+ssize_t sys_pwritev(bool kernel, int fd, fs_off_t pos,
+                    const struct iovec *vec, int count);
 int sys_ioctl(bool kernel, int fd, int cmd, void *arg, size_t sz);
+int sys_fallocate(bool kernel, int fd, int mode, fs_off_t pos, fs_off_t len);
 int sys_unlink(bool kernel, int fd, const char *path);
 int sys_link(bool kernel, int ofd, const char *oldpath, int nfd,
              const char *newpath);
@@ -29,6 +38,8 @@ int sys_ioctl(bool kernel, int fd, int cmd, void *arg, size_t sz);
 int sys_opendir(bool kernel, int fd, const char *path, bool coe);
 int  sys_readdir(bool kernel, int fd, struct my_dirent *buf, size_t bufsize,
                  long count);
+int sys_readdirplus(bool kernel, int fd, struct my_direntplus *buf,
+                    size_t bufsize, long count);
 int sys_rewinddir(bool kernel, int fd);
 int sys_closedir(bool kernel, int fd);
 int sys_chdir(bool kernel, int fd, const char *path);
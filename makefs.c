@@ -45,10 +45,13 @@ main(int argc, char **argv)
     int        block_size = 1024, i;
     char      *disk_name = "big_file";
     char      *volume_name = "untitled";
+    char      *opts = NULL;
     myfs_info  *myfs;
 
     for (i=1; i < argc; i++) {
-        if (isdigit(argv[i][0])) {
+        if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+            opts = argv[++i];
+        } else if (isdigit(argv[i][0])) {
             block_size = strtoul(argv[i], NULL, 0);
         } else if (disk_name == NULL) {
             disk_name = argv[i];
@@ -65,7 +68,7 @@ main(int argc, char **argv)
 
     init_block_cache(256, 0);
 
-    myfs = myfs_create_fs(disk_name, volume_name, block_size, NULL);
+    myfs = myfs_create_fs(disk_name, volume_name, block_size, opts);
     if (myfs != NULL)
         printf("MYFS w/%d byte blocks successfully created on %s as %s\n",
                block_size, disk_name, volume_name);
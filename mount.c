@@ -20,17 +20,73 @@
 
 
 
+/*
+  opts is a comma separated list of options for a new file system:
+
+     extents     keep free space as extents instead of searching the bitmap
+     delalloc    don't give file data blocks until it's written back
+     inline[=N]  N byte inodes (512 by default) that hold small files
+     extentmap   map file blocks with extents instead of block pointers
+*/
+static int
+parse_create_opts(char *opts, uint32 *features, uint32 *inode_size)
+{
+    char *opt, *end;
+    int   len;
+
+    *features   = 0;
+    *inode_size = sizeof(myfs_inode);
+    if (opts == NULL)
+        return 0;
+
+    for(opt=opts; *opt; opt=end) {
+        end = strchr(opt, ',');
+        if (end == NULL)
+            end = opt + strlen(opt);
+        len = end - opt;
+
+        if (len == 7 && strncmp(opt, "extents", len) == 0) {
+            *features |= MYFS_FEATURE_EXTENT_ALLOC;
+        } else if (len == 8 && strncmp(opt, "delalloc", len) == 0) {
+            *features |= MYFS_FEATURE_DELALLOC;
+        } else if (len == 9 && strncmp(opt, "extentmap", len) == 0) {
+            *features |= MYFS_FEATURE_EXTENT_MAP;
+        } else if (len == 6 && strncmp(opt, "inline", len) == 0) {
+            *features  |= MYFS_FEATURE_INLINE_DATA;
+            *inode_size = DEFAULT_INLINE_INODE_SIZE;
+        } else if (len > 7 && strncmp(opt, "inline=", 7) == 0) {
+            *features  |= MYFS_FEATURE_INLINE_DATA;
+            *inode_size = strtoul(opt + 7, NULL, 0);
+        } else if (len != 0) {
+            printf("unknown file system option: %.*s\n", len, opt);
+            return EINVAL;
+        }
+
+        if (*end == ',')
+            end++;
+    }
+
+    return 0;
+}
+
+
 myfs_info *
 myfs_create_fs(char *device, char *name, int block_size, char *opts)
 {
     int        dev_block_size, bshift, warned = 0;
+    uint32     features, inode_size;
     char      *ptr;
     fs_off_t   num_dev_blocks;
     myfs_info *myfs;
 
-    if ((block_size % sizeof(myfs_inode)) != 0) {
+    if (parse_create_opts(opts, &features, &inode_size) != 0)
+        return NULL;
+
+    if (inode_size < sizeof(myfs_inode) || inode_size > block_size ||
+        (block_size % inode_size) != 0 ||
+        (inode_size % sizeof(myfs_inode)) != 0) {
         printf("ERROR: inode size %d is not an even divisor of the block "
-               "size %d\n", sizeof(myfs_inode), block_size);
+               "size %d\n", inode_size, block_size);
         printf("       check myfs.h for more details and info.\n");
         return NULL;
     }
@@ -71,6 +127,7 @@ myfs_create_fs(char *device, char *name, int block_size, char *opts)
     }
 
     myfs->fd = -1;
+    myfs->sb_dirty = 1;             /* nothing goes to disk until it's done */
 
     myfs->nsid = (nspace_id)myfs;   /* we can only do this when creating */
     
@@ -78,6 +135,8 @@ myfs_create_fs(char *device, char *name, int block_size, char *opts)
     myfs->dsb.magic2 = SUPER_BLOCK_MAGIC2;
     myfs->dsb.magic3 = SUPER_BLOCK_MAGIC3;
     myfs->dsb.fs_byte_order = MYFS_BIG_ENDIAN;  /* checked when mounting */
+    myfs->dsb.features = features;
+    myfs->dsb.inode_size = inode_size;
 
     myfs->sem = create_sem(MAX_READERS, "myfs_sem");
     if (myfs->sem < 0) {
@@ -299,9 +358,18 @@ myfs_mount(nspace_id nsid, const char *device, ulong flags,
         goto error2;
     }
 
-    if ((myfs->dsb.block_size % sizeof(myfs_inode)) != 0) {
+    /* the used block count gets redone from the bitmap below anyway */
+    if (myfs->dsb.flags != MYFS_CLEAN)
+        printf("myfs: %s was not unmounted cleanly\n", device);
+
+    /* see myfs.h: it's junk on volumes made before it was there */
+    if ((myfs->dsb.features & MYFS_FEATURE_INLINE_DATA) == 0)
+        myfs->dsb.inode_size = sizeof(myfs_inode);
+
+    if ((myfs->dsb.block_size % INODE_SIZE(myfs)) != 0 ||
+        INODE_SIZE(myfs) < sizeof(myfs_inode)) {
         printf("ERROR: inode size %d is not an even divisor of the block "
-               "size %d\n", sizeof(myfs_inode), myfs->dsb.block_size);
+               "size %d\n", INODE_SIZE(myfs), myfs->dsb.block_size);
         printf("       check myfs.h for more details and info.\n");
         ret = EINVAL;
         goto error2;
@@ -386,8 +454,15 @@ myfs_unmount(void *ns)
     if (myfs == NULL)
         return EINVAL;
     
+    myfs_sync_delalloc(myfs);
+    myfs_release_all_windows(myfs);
+    myfs_write_dirty_inodes(myfs);
     sync_journal(myfs);
 
+    /* the maps go out before the super block that says they're good */
+    myfs_write_dirty_bitmap(myfs);
+    myfs_write_dirty_inode_map(myfs);
+
     myfs_shutdown_storage_map(myfs);
     myfs_shutdown_inodes(myfs);
 
@@ -414,3 +489,31 @@ myfs_unmount(void *ns)
 
     return 0;
 }
+
+
+int
+myfs_sync(void *ns)
+{
+    myfs_info *myfs = (myfs_info *)ns;
+    int        err;
+
+    if (myfs == NULL)
+        return EINVAL;
+
+    err = myfs_sync_delalloc(myfs);
+    if (myfs_write_dirty_inodes(myfs) != 0)
+        err = EIO;
+    sync_journal(myfs);
+
+    if (myfs_write_dirty_bitmap(myfs) != 0 ||
+        myfs_write_dirty_inode_map(myfs) != 0)
+        err = EIO;
+
+    flush_device(myfs->fd, 0);
+
+    /* everything it describes is on disk so it can say clean again */
+    if (myfs->sb_dirty && write_super_block(myfs) != 0)
+        err = EIO;
+
+    return err;
+}
@@ -17,6 +17,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
@@ -54,12 +55,53 @@ typedef struct data_stream
     fs_off_t size;
 } data_stream;
 
+/*
+   a block that was preallocated but never written has this bit set in
+   its block pointer.  reading it gives zeros and writing it clears the
+   bit.  the pointer without the bit is the block's real address.
+*/
+#define UNWRITTEN_BLOCK     ((fs_off_t)1 << (OFF_T_SIZE * 8 - 2))
+#define BLOCK_ADDR(x)       ((x) & ~UNWRITTEN_BLOCK)
+
+/*
+   a run of a file's blocks that file_pos_to_entry() looked up: len
+   blocks from file block lblock on are at entry, entry + 1, ...
+   (UNWRITTEN_BLOCK bit and all).  see dstream.c.
+*/
+typedef struct block_map {
+    fs_off_t  lblock;
+    fs_off_t  len;
+    fs_off_t  entry;
+} block_map;
+
+#define MAP_CACHE_RUNS      8
+
 
 
 typedef struct myfs_inode_etc {  /* these fields are needed when in memory */
     lock   lock;                 /* guard access to this inode */
     char  *contents;             /* contents of a directory */
     int    counter;
+
+    /* written data that doesn't have blocks yet (see dstream.c) */
+    char              *da_buf;       /* file data from da_start on */
+    fs_off_t           da_start;     /* block aligned file offset of da_buf */
+    fs_off_t           da_reserved;  /* blocks set aside for it */
+    bigtime_t          da_time;      /* when the data was first buffered */
+    struct myfs_inode *da_next;      /* next inode with delayed data */
+
+    int                opens;        /* # of open file descriptors */
+    struct rsv_window *rsv;          /* blocks set aside for it (bitmap.h) */
+
+    char              *inline_data;  /* INLINE_SIZE() bytes, if there are any */
+
+    /* changes not copied to the inode table yet (see inode.c) */
+    char               dirty;
+    bigtime_t          dirty_time;   /* when it was first changed */
+    struct myfs_inode *dirty_next, *dirty_prev;
+
+    block_map          map[MAP_CACHE_RUNS];  /* what's mapped, in order */
+    int                map_count;
 } myfs_inode_etc;
 
 
@@ -94,6 +136,7 @@ typedef struct myfs_inode
 #define ATTR_INODE        0x00000004  /* this inode refers to an attribute */
 #define INODE_LOGGED      0x00000008  /* log all i/o to this inode's data */
 #define INODE_DELETED     0x00000010  /* this inode has been deleted */
+#define INODE_INLINE      0x00000020  /* the data is in the inode, no blocks */
 
 #define PERMANENT_FLAGS   0x0000ffff  /* mask for permanent flags */
 
@@ -158,20 +201,115 @@ typedef struct myfs_super_block        /* the super block as it is on disk */
     fs_off_t     log_end;              /* block # of the end of the log */
 
     int32        magic3;
+
+    /*
+       these came later.  older volumes have zero in features (it's
+       the padding that used to follow magic3) but whatever was in
+       memory after the super block in inode_size.  so inode_size only
+       counts with MYFS_FEATURE_INLINE_DATA.
+    */
+    uint32       features;             /* MYFS_FEATURE_xxx, set by makefs */
+    uint32       inode_size;           /* bytes per inode */
 } myfs_super_block;
 
 
 #define MYFS_CLEAN   0x434c454e        /* 'CLEN', for flags field */ 
 #define MYFS_DIRTY   0x44495254        /* 'DIRT', for flags field */ 
 
+/* bits for the features field */
+#define MYFS_FEATURE_EXTENT_ALLOC  0x00000001  /* free space kept as extents */
+#define MYFS_FEATURE_DELALLOC      0x00000002  /* give file data blocks late */
+#define MYFS_FEATURE_INLINE_DATA   0x00000004  /* small files live in the inode */
+#define MYFS_FEATURE_EXTENT_MAP    0x00000008  /* file blocks mapped by extents */
+
+/*
+  with MYFS_FEATURE_INLINE_DATA each inode in the inode table is
+  inode_size bytes instead of sizeof(myfs_inode).  the rest of it holds
+  the data of a file small enough to fit (see dstream.c).
+*/
+#define INODE_SIZE(x)      ((x)->dsb.inode_size)
+#define INLINE_SIZE(x)     (INODE_SIZE(x) - sizeof(myfs_inode))
+#define DEFAULT_INLINE_INODE_SIZE  512
+
+
+/*
+  the block bitmap is summarized BBM_GROUP_BITS blocks at a time so the
+  allocator can tell where a run of free blocks will fit without having
+  to scan the bitmap itself.
+*/
+#define BBM_GROUP_SHIFT  10
+#define BBM_GROUP_BITS   (1 << BBM_GROUP_SHIFT)
+
+/*
+  the disk is split into allocation groups, one per summary group.  each
+  has its own lock covering its part of the block bitmap and of the
+  inode map so allocations in different groups don't wait on each other.
+*/
+typedef struct alloc_group
+{
+    sem_id      sem;
+    int         free_inodes;
+} alloc_group;
 
 typedef struct block_bitmap
 {
-    BitVector  *bv;
+    BitVector  *bv;               /* what allocations search (see bitmap.c) */
+    BitVector  *disk;             /* what goes to disk */
     fs_off_t    num_bitmap_blocks;
+    BVRange    *groups;           /* one summary per group of blocks */
+    int         num_groups;
+    int         biggest_free;     /* longest free run, -1 if not known */
+
+    struct free_map *fm;          /* free extents, if MYFS_FEATURE_EXTENT_ALLOC */
+    fs_off_t    reserved;         /* free blocks promised to delayed data */
+
+    struct rsv_window *windows;   /* per-file reservation windows */
+    fs_off_t    rsv_blocks;       /* blocks sitting unused in windows */
+    long        rsv_hits;         /* allocations served from a window */
+    long        rsv_fills;        /* windows made or refilled */
+    fs_off_t    rsv_returned;     /* window blocks that went unused */
+
+    uchar      *dirty;            /* bitmap blocks changed since written */
+    int         num_dirty;
+
+    long        alloc_calls;      /* allocator statistics */
+    long        free_calls;
+    bigtime_t   alloc_time;       /* time spent finding and freeing runs */
 } block_bitmap;
 
 
+/*
+  in-memory inodes (a myfs_inode and its myfs_inode_etc together) are
+  allocated INODE_SLAB_COUNT at a time and kept on a free list when
+  their vnode goes away, lock and all, so loading an inode again
+  doesn't go through malloc or create a semaphore.  see inode.c.
+*/
+#define INODE_SLAB_COUNT  64
+#define INODE_RECENT      256        /* released inode #'s remembered */
+#define INODE_PREFETCH    64         /* inode table blocks read ahead */
+
+typedef struct inode_cache
+{
+    sem_id             sem;           /* guards the free list */
+    struct inode_obj  *free;          /* released inodes, ready to reuse */
+    struct inode_slab *slabs;         /* every chunk of them allocated */
+    inode_addr         recent[INODE_RECENT];  /* released, by ino % size */
+
+    fs_off_t           last_block;    /* inode table block last loaded from */
+    int                seq;           /* blocks in a row after it */
+    fs_off_t           ra_end;        /* table prefetched up to here */
+
+    int                obj_size;      /* bytes per object, inline data too */
+
+    long               slabs_made;    /* statistics */
+    long               gets;
+    long               reuses;        /* gets that didn't need a new slab */
+    long               recent_hits;   /* loads of an inode just released */
+    long               batched;       /* inodes loaded by myfs_load_inodes */
+    long               prefetches;    /* reads done ahead of inode loads */
+} inode_cache;
+
+
 #define NUM_TMP_BLOCKS   16
 
 typedef struct tmp_blocks
@@ -194,11 +332,20 @@ typedef struct myfs_info
 {
     nspace_id        nsid;
     myfs_super_block dsb;     /* as read from disk */
+    char             sb_dirty; /* the one on disk says MYFS_DIRTY (io.c) */
+    long             sb_writes;
 
     block_bitmap     bbm;     /* keeps track of which blocks are allocated */
     sem_id           bbm_sem;
 
     BitVector        inode_map;  /* keeps track which inodes are allocated */
+    uchar           *inode_map_dirty;  /* its blocks changed since written */
+    long             map_writes; /* bitmap and inode map writes to the cache */
+
+    inode_cache      icache;     /* in-memory inode objects */
+
+    alloc_group     *ags;     /* bbm.num_groups of them */
+    int              inodes_per_group;
 
     sem_id           sem;     /* guard access to this structure */
 
@@ -228,6 +375,28 @@ typedef struct myfs_info
 
     sem_id           tmp_blocks_sem;
     tmp_blocks      *tmp_blocks;
+
+    /* inodes with delayed data, oldest first, and what happened to it */
+    myfs_inode      *da_head, *da_tail;
+    long             da_flushes;
+    fs_off_t         da_flushed;     /* blocks that got allocated */
+    fs_off_t         da_dropped;     /* blocks never allocated at all */
+
+    long             inline_moved;   /* files that outgrew their inode */
+
+    /* inodes changed in memory only, oldest first */
+    myfs_inode      *dirty_head, *dirty_tail;
+    long             inode_writes;   /* copies into the inode table */
+    long             inode_deferred; /* changes that didn't need one */
+
+    long             extent_nodes;   /* extent tree blocks made */
+
+    long             map_hits;       /* lookups the block map cache had */
+    long             map_misses;     /* ones that had to read the mapping */
+    long             read_runs;      /* reads straight into the caller */
+    long             read_run_blocks;
+    long             write_runs;     /* writes straight from the caller */
+    long             write_run_blocks;
 } myfs_info;
 
 
@@ -244,15 +413,24 @@ typedef struct myfs_info
 /* flags for the myfs_info flags field */
 #define FS_READ_ONLY         0x00000001
 
+/* ioctl's understood by myfs_ioctl() */
+#define MYFS_IOCTL_COUNT_EXTENTS  0x4d590001  /* buf is an int: # of runs */
+#define MYFS_IOCTL_RELOCATE       0x4d590002  /* move file into one run */
+
 /* how many free blocks are there on a volume */
-#define NUM_FREE_BLOCKS(x) ((x)->dsb.num_blocks - (x)->dsb.used_blocks)
+#define NUM_FREE_BLOCKS(x) ((x)->dsb.num_blocks - myfs_used_blocks(x))
+
+/* how many of them aren't spoken for by delayed allocations */
+#define NUM_AVAIL_BLOCKS(x) (NUM_FREE_BLOCKS(x) - (x)->bbm.reserved)
 
 
 #include "mount.h"
 #include "bitmap.h"
+#include "freemap.h"
 #include "journal.h"
 #include "inode.h"
 #include "dstream.h"
+#include "extent.h"
 #include "dir.h"
 #include "file.h"
 #include "io.h"
@@ -32,5 +32,10 @@ vnode_ops myfs_ops =  {
       &myfs_fsync,
       &myfs_mount,
       &myfs_unmount,
-      NULL                    /* sync */
+      &myfs_sync,
+      &myfs_readv,
+      &myfs_writev,
+      &myfs_readdirplus,
+      &myfs_fallocate,
+      &myfs_read_vnodes
 };
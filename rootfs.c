@@ -133,6 +133,11 @@ vnode_ops rootfs =  {
     NULL,
     &rootfs_mount,
     &rootfs_unmount,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
     NULL
 };
 
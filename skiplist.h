@@ -65,6 +65,9 @@ void       FreeSL(SkipList l);
 int    InsertSL(SkipList l, void *key);
 int    DeleteSL(SkipList l, void *key);
 void      *SearchSL(SkipList l, void *key);
+void      *SearchGESL(SkipList l, void *key);
+void      *SearchLTSL(SkipList l, void *key);
+void      *LastSL(SkipList l);
 void       DoForSL(SkipList  l, int (*function)(), void *arg);
 void       DoForRangeSL(SkipList l, void *key, int (*compare)(),
             int (*func)(), void *arg);
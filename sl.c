@@ -280,6 +280,72 @@ void *SearchSL(SkipList l, void *key)
 }
 
 
+/* return the first item that is >= key, or NULL if there isn't one */
+void *SearchGESL(SkipList l, void *key)
+{
+  register int k;
+  register SLNode p,q;
+  int (*compare)() = l->compare;
+
+  p = l->header;
+  
+  for(k=l->level-1; k >= 0; k--)
+   {
+     while((q = p->forward[k]) && (*compare)(q->key, key) < 0)
+    p = q;
+   }
+
+  q = p->forward[0];
+  if (q == NULL)
+    return NULL;
+
+  return q->key;
+}
+
+
+/* return the last item that is < key, or NULL if there isn't one */
+void *SearchLTSL(SkipList l, void *key)
+{
+  register int k;
+  register SLNode p,q;
+  int (*compare)() = l->compare;
+
+  p = l->header;
+  
+  for(k=l->level-1; k >= 0; k--)
+   {
+     while((q = p->forward[k]) && (*compare)(q->key, key) < 0)
+    p = q;
+   }
+
+  if (p == l->header)
+    return NULL;
+
+  return p->key;
+}
+
+
+/* return the last item in the list, or NULL if it's empty */
+void *LastSL(SkipList l)
+{
+  register int k;
+  register SLNode p,q;
+
+  p = l->header;
+  
+  for(k=l->level-1; k >= 0; k--)
+   {
+     while((q = p->forward[k]))
+    p = q;
+   }
+
+  if (p == l->header)
+    return NULL;
+
+  return p->key;
+}
+
+
 void DoForSL(SkipList l, int (*function)(), void *arg)
 {
   register SLNode p,q, fix;
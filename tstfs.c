@@ -38,6 +38,7 @@
 
 char      buf[MAX_FILES][MAX_NAME];
 fs_off_t  sizes[MAX_FILES];
+int       seeds[MAX_FILES];
 
 
 static void
@@ -66,52 +67,125 @@ SubTime(struct timeval *a, struct timeval *b, struct timeval *c)
 }
 
 
-static void
-write_rand_data(int fd, int max_data)
+/*
+  a file's contents are a function of its seed so the verify pass can
+  check every byte.  it's written in random sized pieces.  one file in
+  four has its space preallocated unwritten first and some of its
+  pieces skipped, so those have to read back as zeros.  (only those:
+  writing past the end of a file doesn't zero the gap it leaves.)
+*/
+#define MAX_PIECE  4096
+#define PREALLOCATED(seed)  (((seed) & 3) == 0)
+
+static int
+seed_rand(unsigned *state)
 {
-    int    i, k, err;
-    size_t j;
-    static char buf[4096];
-    ulong  sum = 0;
-
-    for(i=0; max_data > 0; i++) {
-        j = rand() % sizeof(buf);
-        if ((int)(max_data - j) < 0)
-            j = max_data;
-        
-        memset(buf, rand() >> 8, j);
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 16) & 0x7fff;
+}
 
-        for(k=0; k < j; k++)
-            sum += buf[k];
-        
-        /* printf("write: %d\n", j); */
-        err = sys_write(1, fd, buf, j);
-        if (err != j) {
+static char
+data_byte(int seed, fs_off_t pos)
+{
+    return (char)(seed + pos + (pos >> 10) * ((seed >> 8) | 1));
+}
+
+static int
+next_piece(unsigned *state, int seed, int pos, int size, int *hole)
+{
+    int len = (seed_rand(state) % MAX_PIECE) + 1;
+
+    *hole = 0;
+    if (pos + len >= size)     /* the last piece is written to set the size */
+        len = size - pos;
+    else if (PREALLOCATED(seed))
+        *hole = (seed_rand(state) % 4) == 0;
+
+    return len;
+}
+
+
+static int
+write_rand_data(int fd, int max_data, int seed)
+{
+    int      err, hole, len, pos;
+    unsigned state = seed;
+    static char buf[MAX_PIECE];
+
+    if (PREALLOCATED(seed))
+        sys_fallocate(1, fd, MY_FALLOC_UNWRITTEN | MY_FALLOC_KEEP_SIZE, 0,
+                      max_data);
+
+    for(pos=0; pos < max_data; pos += len) {
+        len = next_piece(&state, seed, pos, max_data, &hole);
+        if (hole) {
+            sys_lseek(1, fd, len, SEEK_CUR);
+            continue;
+        }
+
+        for(err=0; err < len; err++)
+            buf[err] = data_byte(seed, pos + err);
+
+        err = sys_write(1, fd, buf, len);
+        if (err != len) {
             errno = err;
             perror("write_rand_data");
-            printf("err %d j %d\n", err, j);
+            printf("err %d len %d\n", err, len);
             if (errno != ENOSPC)
                 while(1)
                     sleep(1);
             break;
         }
+    }
+
+    return pos;                 /* how much of it there really is */
+}
 
-        max_data -= j;
+
+/*
+  read the file back a piece of a block or more at a time, so reads go
+  straight into our buffer, and compare it to what it should hold.
+*/
+static int
+check_data(int fd, int size, int seed, const char *name)
+{
+    int      hole, len, pos, rlen, got, errors = 0;
+    unsigned state = seed;
+    static char want[65536], rbuf[16384];
+
+    for(pos=0; pos < size; pos += len) {
+        len = next_piece(&state, seed, pos, size, &hole);
+        for(got=0; got < len; got++)
+            want[pos + got] = hole ? 0 : data_byte(seed, pos + got);
     }
 
-#if INSANELY_SLOW_CHECKSUM
-    pos = 0;
-    err = sys_lseek(1, fd, SEEK_SET, &pos);
-    for(i=0; i < max; i++) {
-        j = sizeof(buf);
-        sys_read(1, fd, buf, j);
-        for(k=0; k < j; k++)
-            nsum += buf[k];
+    sys_lseek(1, fd, 0, SEEK_SET);
+    for(pos=0; pos < size && errors == 0; pos += got) {
+        rlen = 4096 + (rand() % (sizeof(rbuf) - 4096));
+        got  = sys_read(1, fd, rbuf, rlen);
+        if (got <= 0) {
+            printf("read of %s at %d returned %d\n", name, pos, got);
+            errors++;
+            break;
+        }
+        if (pos + got > size) {
+            printf("read of %s at %d went past the end (%d)\n", name, pos,
+                   got);
+            errors++;
+            break;
+        }
+
+        for(len=0; len < got; len++) {
+            if (rbuf[len] != want[pos + len]) {
+                printf("data mismatch in %s at %d: 0x%x != 0x%x\n", name,
+                       pos + len, rbuf[len] & 0xff, want[pos + len] & 0xff);
+                errors++;
+                break;
+            }
+        }
     }
 
-    if (sum != nsum)
-        printf("sum = 0x%x, nsum 0x%x\n", sum, nsum);
-#endif
+    return errors;
 }
 
 
@@ -119,6 +193,7 @@ int
 main(int argc, char **argv)
 {
     int             i, j, fd, seed, err, size, sum, name_size = 0;
+    int             errors = 0;
     struct my_stat  st;
     struct timeval  start, end, result;
     char           *disk_name = "big_file";
@@ -162,7 +237,7 @@ main(int argc, char **argv)
             make_random_name(&buf[j][6], MAX_NAME-6);
             name_size += strlen(&buf[j][6]);
             
-            sum += sizes[j] = size;
+            seeds[j] = rand();
             
             /* printf("\rcreating: %s %d bytes", &buf[j][0], size); */
 
@@ -174,7 +249,7 @@ main(int argc, char **argv)
                 break;
             }
             
-            write_rand_data(fd, size);
+            sum += sizes[j] = write_rand_data(fd, size, seeds[j]);
 
             sys_close(1, fd);
         } else {                      /* then delete the file */
@@ -213,6 +288,8 @@ main(int argc, char **argv)
     printf("\rcreated %d files in %2ld.%.6ld seconds (%d k data)\n", i,
            result.tv_sec, result.tv_usec, sum/1024);
     
+    sys_sync();     /* so delayed data is read back from its blocks */
+
     printf("now verifying files....\n");
     for(i=0; i < MAX_FILES; i++) {
         if (buf[i][0] == '\0')
@@ -238,12 +315,21 @@ main(int argc, char **argv)
         if (st.size != sizes[i]) {
             printf("size mismatch on %s: %ld != %ld\n", &buf[i][0],
                    st.size, sizes[i]);
+            errors++;
+        } else {
+            errors += check_data(fd, sizes[i], seeds[i], &buf[i][0]);
         }
 
         sys_close(1, fd);
     }
     printf("done verifying files                                         \n");
 
+    if (errors) {
+        printf("%d files failed to verify\n", errors);
+        sys_unmount(1, -1, "/myfs");
+        return 6;
+    }
+
     if (sys_unmount(1, -1, "/myfs") != 0) {
         printf("could not UNmount /myfs\n");
         return 5;